@@ -137,6 +137,17 @@ bool utf8_is_printable_newline(const char* str, size_t length, bool newline) {
                 int encoded_len, r;
                 char32_t val;
 
+                /* Shortcut for plain ASCII, which is what we see most of the time */
+                if ((uint8_t) *p < 0x80) {
+                        if (unichar_is_control((char32_t) *p) ||
+                            (!newline && *p == '\n'))
+                                return false;
+
+                        length--;
+                        p++;
+                        continue;
+                }
+
                 encoded_len = utf8_encoded_valid_unichar(p);
                 if (encoded_len < 0 ||
                     (size_t) encoded_len > length)
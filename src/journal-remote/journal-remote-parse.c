@@ -48,14 +48,26 @@ RemoteSource* source_new(int fd, bool passive_fd, char *name, Writer *writer) {
 }
 
 int process_source(RemoteSource *source, bool compress, bool seal) {
-        int r;
+        int r, k;
 
         assert(source);
         assert(source->writer);
 
         r = journal_importer_process_data(&source->importer);
-        if (r <= 0)
+        if (r <= 0) {
+                /* Entries are written out in batches. Do so for what we have collected before we go back
+                 * to waiting for more data, or give up on this source. */
+                if (r < 0 || journal_importer_eof(&source->importer)) {
+                        k = writer_flush(source->writer, compress, seal);
+                        if (k < 0) {
+                                log_error_errno(k, "Failed to write entries: %m");
+                                if (r == -EAGAIN)
+                                        return k;
+                        }
+                }
+
                 return r;
+        }
 
         /* We have a full event */
         log_trace("Received full event from source@%p fd:%d (%s)",
@@ -69,10 +81,7 @@ int process_source(RemoteSource *source, bool compress, bool seal) {
         assert(source->importer.iovw.iovec);
 
         r = writer_write(source->writer, &source->importer.iovw, &source->importer.ts, compress, seal);
-        if (r == -EBADMSG) {
-                log_error_errno(r, "Entry is invalid, ignoring.");
-                r = 0;
-        } else if (r < 0)
+        if (r < 0)
                 log_error_errno(r, "Failed to write entry of %zu bytes: %m",
                                 iovw_size(&source->importer.iovw));
         else
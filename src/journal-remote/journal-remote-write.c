@@ -3,6 +3,9 @@
 #include "alloc-util.h"
 #include "journal-remote.h"
 
+/* How many entries to collect at most before writing them out */
+#define WRITER_BATCH_MAX 64U
+
 static int do_rotate(JournalFile **f, bool compress, bool seal) {
         int r = journal_file_rotate(f, compress, (uint64_t) -1, seal, NULL);
         if (r < 0) {
@@ -39,6 +42,16 @@ static Writer* writer_free(Writer *w) {
                 return NULL;
 
         if (w->journal) {
+                /* Don't lose what we collected already, but this is too late to do anything about failures */
+                if (w->batch.n_written < w->batch.n_entries) {
+                        int r;
+
+                        r = journal_file_append_batch(w->journal, &w->batch, &w->seqnum);
+                        if (r < 0)
+                                log_error_errno(r, "%s: Failed to write %zu entries: %m",
+                                                w->journal->path, w->batch.n_entries - w->batch.n_written);
+                }
+
                 log_debug("Closing journal file %s.", w->journal->path);
                 journal_file_close(w->journal);
         }
@@ -48,6 +61,8 @@ static Writer* writer_free(Writer *w) {
 
         free(w->hashmap_key);
 
+        journal_batch_done(&w->batch);
+
         if (w->mmap)
                 mmap_cache_unref(w->mmap);
 
@@ -67,39 +82,71 @@ int writer_write(Writer *w,
         assert(iovw);
         assert(iovw->count > 0);
 
+        /* The entry is only queued here, and written out together with others once we collected enough
+         * of them, or by writer_flush() once the source runs dry. */
+        r = journal_batch_add(&w->batch, ts, iovw->iovec, iovw->count);
+        if (r < 0)
+                return r;
+
+        if (w->batch.n_entries >= WRITER_BATCH_MAX)
+                return writer_flush(w, compress, seal);
+
+        return 0;
+}
+
+int writer_flush(Writer *w, bool compress, bool seal) {
+        bool rotated = false;
+        int r = 0;
+
+        assert(w);
+
+        if (w->batch.n_entries == 0)
+                return 0;
+
         if (journal_file_rotate_suggested(w->journal, 0)) {
                 log_info("%s: Journal header limits reached or header out-of-date, rotating",
                          w->journal->path);
                 r = do_rotate(&w->journal, compress, seal);
                 if (r < 0)
-                        return r;
+                        goto finish;
         }
 
-        r = journal_file_append_entry(w->journal, ts, NULL,
-                                      iovw->iovec, iovw->count,
-                                      &w->seqnum, NULL, NULL);
-        if (r >= 0) {
-                if (w->server)
-                        w->server->event_count += 1;
-                return 0;
-        } else if (r == -EBADMSG)
-                return r;
+        while (w->batch.n_written < w->batch.n_entries) {
+                size_t n_written = w->batch.n_written;
 
-        log_debug_errno(r, "%s: Write failed, rotating: %m", w->journal->path);
-        r = do_rotate(&w->journal, compress, seal);
-        if (r < 0)
-                return r;
-        else
-                log_debug("%s: Successfully rotated journal", w->journal->path);
+                r = journal_file_append_batch(w->journal, &w->batch, &w->seqnum);
+                if (w->batch.n_written > n_written) {
+                        if (w->server)
+                                w->server->event_count += w->batch.n_written - n_written;
 
-        log_debug("Retrying write.");
-        r = journal_file_append_entry(w->journal, ts, NULL,
-                                      iovw->iovec, iovw->count,
-                                      &w->seqnum, NULL, NULL);
-        if (r < 0)
-                return r;
+                        rotated = false;
+                }
+                if (r >= 0)
+                        break;
 
-        if (w->server)
-                w->server->event_count += 1;
-        return 0;
+                if (r == -EBADMSG) {
+                        log_error_errno(r, "Entry is invalid, ignoring.");
+                        w->batch.n_written++;
+                        r = 0;
+                        continue;
+                }
+
+                /* We rotated already, and still could not write this entry, give up */
+                if (rotated)
+                        goto finish;
+
+                log_debug_errno(r, "%s: Write failed, rotating: %m", w->journal->path);
+                r = do_rotate(&w->journal, compress, seal);
+                if (r < 0)
+                        goto finish;
+                else
+                        log_debug("%s: Successfully rotated journal", w->journal->path);
+
+                rotated = true;
+                log_debug("Retrying write.");
+        }
+
+finish:
+        journal_batch_clear(&w->batch);
+        return r;
 }
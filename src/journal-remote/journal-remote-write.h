@@ -10,6 +10,9 @@ typedef struct Writer {
         JournalFile *journal;
         JournalMetrics metrics;
 
+        /* Entries received but not written to the journal file yet */
+        JournalBatch batch;
+
         MMapCache *mmap;
         RemoteServer *server;
         char *hashmap_key;
@@ -30,6 +33,7 @@ int writer_write(Writer *s,
                  dual_timestamp *ts,
                  bool compress,
                  bool seal);
+int writer_flush(Writer *w, bool compress, bool seal);
 
 typedef enum JournalWriteSplitMode {
         JOURNAL_WRITE_SPLIT_NONE,
@@ -71,6 +71,14 @@ static int open_output(RemoteServer *s, Writer *w, const char* host) {
         if (r < 0)
                 return log_error_errno(r, "Failed to open output journal %s: %m", filename);
 
+        /* Entries usually arrive in bursts, hence don't notify readers of every single one of them, but
+         * coalesce the notifications like journald does. Rotated files inherit this. */
+        r = journal_file_enable_post_change_timer(w->journal, s->events, POST_CHANGE_TIMER_INTERVAL_USEC);
+        if (r < 0) {
+                w->journal = journal_file_close(w->journal);
+                return log_error_errno(r, "Failed to enable post change timer for %s: %m", filename);
+        }
+
         log_debug("Opened output file %s", w->journal->path);
         return 0;
 }
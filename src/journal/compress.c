@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -15,6 +16,12 @@
 #include <lz4frame.h>
 #endif
 
+#if HAVE_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#include <zstd_errors.h>
+#endif
+
 #include "alloc-util.h"
 #include "compress.h"
 #include "fd-util.h"
@@ -31,11 +38,168 @@ DEFINE_TRIVIAL_CLEANUP_FUNC(LZ4F_compressionContext_t, LZ4F_freeCompressionConte
 DEFINE_TRIVIAL_CLEANUP_FUNC(LZ4F_decompressionContext_t, LZ4F_freeDecompressionContext);
 #endif
 
+#if HAVE_ZSTD
+DEFINE_TRIVIAL_CLEANUP_FUNC(ZSTD_CCtx*, ZSTD_freeCCtx);
+DEFINE_TRIVIAL_CLEANUP_FUNC(ZSTD_DCtx*, ZSTD_freeDCtx);
+
+struct CompressDictionary {
+        void *data;
+        size_t size;
+        unsigned id;
+        ZSTD_DDict *ddict;
+        ZSTD_CDict *cdict; /* only created when we compress with it */
+};
+
+/* Setting up a compression context costs about four times as much as compressing a typical log line with
+ * it, hence keep one around per thread and reuse it for all blobs we compress. The context is stored in a
+ * thread-specific key, so that it is freed again when the thread exits. */
+static pthread_once_t blob_cctx_once = PTHREAD_ONCE_INIT;
+static pthread_key_t blob_cctx_key;
+static bool blob_cctx_key_valid = false;
+
+static void blob_cctx_free(void *p) {
+        ZSTD_freeCCtx(p);
+}
+
+static void blob_cctx_key_init(void) {
+        blob_cctx_key_valid = pthread_key_create(&blob_cctx_key, blob_cctx_free) == 0;
+}
+
+static ZSTD_CCtx *blob_cctx_get(void) {
+        ZSTD_CCtx *c;
+
+        assert_se(pthread_once(&blob_cctx_once, blob_cctx_key_init) == 0);
+        if (!blob_cctx_key_valid)
+                return NULL;
+
+        c = pthread_getspecific(blob_cctx_key);
+        if (c)
+                return c;
+
+        c = ZSTD_createCCtx();
+        if (!c)
+                return NULL;
+
+        if (pthread_setspecific(blob_cctx_key, c) != 0) {
+                ZSTD_freeCCtx(c);
+                return NULL;
+        }
+
+        return c;
+}
+
+_destructor_ static void blob_cctx_cleanup(void) {
+        ZSTD_CCtx *c;
+
+        /* Thread-specific destructors are not called for the thread that invokes exit(), hence free its
+         * context here. We are also called when the library is unloaded, in which case the key's destructor
+         * must not be called anymore for threads exiting later, hence delete the key. The contexts of other
+         * threads that are still alive are leaked then, there's no way to free them from here. */
+        if (!blob_cctx_key_valid)
+                return;
+
+        blob_cctx_key_valid = false;
+
+        c = pthread_getspecific(blob_cctx_key);
+        if (c) {
+                (void) pthread_setspecific(blob_cctx_key, NULL);
+                ZSTD_freeCCtx(c);
+        }
+
+        (void) pthread_key_delete(blob_cctx_key);
+}
+
+static int zstd_ret_to_errno(size_t ret) {
+        switch (ZSTD_getErrorCode(ret)) {
+        case ZSTD_error_dstSize_tooSmall:
+                return -ENOBUFS;
+        case ZSTD_error_memory_allocation:
+                return -ENOMEM;
+        default:
+                return -EBADMSG;
+        }
+}
+#endif
+
 #define ALIGN_8(l) ALIGN_TO(l, sizeof(size_t))
 
+int compress_dictionary_train(const void *samples, const size_t *sample_sizes, unsigned n_samples,
+                              void *dst, size_t dst_alloc_size, size_t *dst_size) {
+#if HAVE_ZSTD
+        size_t k;
+
+        assert(samples);
+        assert(sample_sizes);
+        assert(n_samples > 0);
+        assert(dst);
+        assert(dst_alloc_size > 0);
+        assert(dst_size);
+
+        k = ZDICT_trainFromBuffer(dst, dst_alloc_size, samples, sample_sizes, n_samples);
+        if (ZDICT_isError(k)) {
+                log_debug("Failed to train ZSTD dictionary: %s", ZDICT_getErrorName(k));
+                return zstd_ret_to_errno(k);
+        }
+
+        *dst_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int compress_dictionary_new(const void *src, size_t src_size, CompressDictionary **ret) {
+#if HAVE_ZSTD
+        _cleanup_(compress_dictionary_freep) CompressDictionary *d = NULL;
+
+        assert(src);
+        assert(ret);
+
+        d = new0(CompressDictionary, 1);
+        if (!d)
+                return -ENOMEM;
+
+        /* Frames refer to the dictionary by its ID, hence only accept dictionaries in zstd's own format
+         * which carry one, and not raw content */
+        d->id = ZDICT_getDictID(src, src_size);
+        if (d->id == 0)
+                return -EBADMSG;
+
+        d->data = memdup(src, src_size);
+        if (!d->data)
+                return -ENOMEM;
+        d->size = src_size;
+
+        d->ddict = ZSTD_createDDict(d->data, d->size);
+        if (!d->ddict)
+                return -ENOMEM;
+
+        *ret = TAKE_PTR(d);
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+CompressDictionary* compress_dictionary_free(CompressDictionary *d) {
+#if HAVE_ZSTD
+        if (!d)
+                return NULL;
+
+        ZSTD_freeCDict(d->cdict);
+        ZSTD_freeDDict(d->ddict);
+        free(d->data);
+
+        return mfree(d);
+#else
+        return NULL;
+#endif
+}
+
 static const char* const object_compressed_table[_OBJECT_COMPRESSED_MAX] = {
         [OBJECT_COMPRESSED_XZ] = "XZ",
         [OBJECT_COMPRESSED_LZ4] = "LZ4",
+        [OBJECT_COMPRESSED_ZSTD] = "ZSTD",
 };
 
 DEFINE_STRING_TABLE_LOOKUP(object_compressed, int);
@@ -112,6 +276,72 @@ int compress_blob_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
+#if HAVE_ZSTD
+static int compress_blob_zstd_internal(const ZSTD_CDict *cdict,
+                                       const void *src, uint64_t src_size,
+                                       void *dst, size_t dst_alloc_size, size_t *dst_size) {
+        _cleanup_(ZSTD_freeCCtxp) ZSTD_CCtx *uncached = NULL;
+        ZSTD_CCtx *c;
+        size_t k;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size > 0);
+        assert(dst_size);
+
+        /* Returns < 0 if we couldn't compress the data or the
+         * compressed result is longer than the original */
+
+        c = blob_cctx_get();
+        if (!c) {
+                /* We can't cache a context (anymore), use one for this call only */
+                c = uncached = ZSTD_createCCtx();
+                if (!c)
+                        return -ENOMEM;
+        }
+
+        if (cdict)
+                k = ZSTD_compress_usingCDict(c, dst, dst_alloc_size, src, src_size, cdict);
+        else
+                k = ZSTD_compressCCtx(c, dst, dst_alloc_size, src, src_size, 0);
+        if (ZSTD_isError(k))
+                return zstd_ret_to_errno(k);
+
+        *dst_size = k;
+        return 0;
+}
+#endif
+
+int compress_blob_zstd(const void *src, uint64_t src_size,
+                       void *dst, size_t dst_alloc_size, size_t *dst_size) {
+#if HAVE_ZSTD
+        return compress_blob_zstd_internal(NULL, src, src_size, dst, dst_alloc_size, dst_size);
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int compress_blob_zstd_dictionary(CompressDictionary *d,
+                                  const void *src, uint64_t src_size,
+                                  void *dst, size_t dst_alloc_size, size_t *dst_size) {
+#if HAVE_ZSTD
+        assert(d);
+
+        /* Digesting the dictionary for compression is a lot more expensive than for decompression, hence
+         * only do it once we need it */
+        if (!d->cdict) {
+                d->cdict = ZSTD_createCDict(d->data, d->size, ZSTD_CLEVEL_DEFAULT);
+                if (!d->cdict)
+                        return -ENOMEM;
+        }
+
+        return compress_blob_zstd_internal(d->cdict, src, src_size, dst, dst_alloc_size, dst_size);
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_blob_xz(const void *src, uint64_t src_size,
                        void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
 
@@ -212,7 +442,102 @@ int decompress_blob_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
-int decompress_blob(int compression,
+#if HAVE_ZSTD
+static int zstd_ref_dictionary(ZSTD_DCtx *dctx, const CompressDictionary *d, const void *src, size_t src_size) {
+        unsigned id;
+        size_t k;
+
+        /* Frames that were compressed with a dictionary carry its ID, all others are decoded without one */
+        id = ZSTD_getDictID_fromFrame(src, src_size);
+        if (id == 0)
+                return 0;
+
+        if (!d || d->id != id) {
+                log_debug("ZSTD frame requires dictionary %u, which is not available.", id);
+                return -EBADMSG;
+        }
+
+        k = ZSTD_DCtx_refDDict(dctx, d->ddict);
+        if (ZSTD_isError(k))
+                return zstd_ret_to_errno(k);
+
+        return 0;
+}
+#endif
+
+int decompress_blob_zstd_dictionary(const CompressDictionary *d,
+                                    const void *src, uint64_t src_size,
+                                    void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
+
+#if HAVE_ZSTD
+        _cleanup_(ZSTD_freeDCtxp) ZSTD_DCtx *dctx = NULL;
+        ZSTD_inBuffer input = {
+                .src = src,
+                .size = src_size,
+        };
+        ZSTD_outBuffer output = {};
+        unsigned long long size;
+        size_t k;
+        int r;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size);
+        assert(dst_size);
+        assert(*dst_alloc_size == 0 || *dst);
+
+        /* ZSTD_compress() always stores the content size in the frame header */
+        size = ZSTD_getFrameContentSize(src, src_size);
+        if (IN_SET(size, ZSTD_CONTENTSIZE_ERROR, ZSTD_CONTENTSIZE_UNKNOWN))
+                return -EBADMSG;
+
+        if (dst_max > 0 && size > dst_max)
+                size = dst_max;
+        if (size > SIZE_MAX)
+                return -EFBIG;
+
+        if (!greedy_realloc(dst, dst_alloc_size, MAX(size, 1u), 1))
+                return -ENOMEM;
+
+        dctx = ZSTD_createDCtx();
+        if (!dctx)
+                return -ENOMEM;
+
+        r = zstd_ref_dictionary(dctx, d, src, src_size);
+        if (r < 0)
+                return r;
+
+        output.dst = *dst;
+        output.size = size;
+
+        /* If dst_max is set we only decode the first dst_max bytes, hence stop as soon as the output
+         * buffer is full. If the frame ends or the input runs out earlier the object is corrupted. */
+        while (output.pos < output.size) {
+                k = ZSTD_decompressStream(dctx, &output, &input);
+                if (ZSTD_isError(k)) {
+                        log_debug("ZSTD decoder failed: %s", ZSTD_getErrorName(k));
+                        return zstd_ret_to_errno(k);
+                }
+                if (output.pos >= output.size)
+                        break;
+                if (k == 0 || input.pos >= input.size)
+                        return -EBADMSG;
+        }
+
+        *dst_size = size;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int decompress_blob_zstd(const void *src, uint64_t src_size,
+                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
+        return decompress_blob_zstd_dictionary(NULL, src, src_size, dst, dst_alloc_size, dst_size, dst_max);
+}
+
+int decompress_blob(int compression, const CompressDictionary *d,
                     const void *src, uint64_t src_size,
                     void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
         if (compression == OBJECT_COMPRESSED_XZ)
@@ -221,6 +546,9 @@ int decompress_blob(int compression,
         else if (compression == OBJECT_COMPRESSED_LZ4)
                 return decompress_blob_lz4(src, src_size,
                                            dst, dst_alloc_size, dst_size, dst_max);
+        else if (compression == OBJECT_COMPRESSED_ZSTD)
+                return decompress_blob_zstd_dictionary(d, src, src_size,
+                                                       dst, dst_alloc_size, dst_size, dst_max);
         else
                 return -EBADMSG;
 }
@@ -333,7 +661,83 @@ int decompress_startswith_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
-int decompress_startswith(int compression,
+int decompress_startswith_zstd_dictionary(const CompressDictionary *d,
+                                          const void *src, uint64_t src_size,
+                                          void **buffer, size_t *buffer_size,
+                                          const void *prefix, size_t prefix_len,
+                                          uint8_t extra) {
+#if HAVE_ZSTD
+        /* Checks whether the decompressed blob starts with the
+         * mentioned prefix. The byte extra needs to follow the
+         * prefix */
+
+        _cleanup_(ZSTD_freeDCtxp) ZSTD_DCtx *dctx = NULL;
+        ZSTD_inBuffer input = {
+                .src = src,
+                .size = src_size,
+        };
+        ZSTD_outBuffer output = {};
+        unsigned long long size;
+        size_t k;
+        int r;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(buffer);
+        assert(buffer_size);
+        assert(prefix);
+        assert(*buffer_size == 0 || *buffer);
+
+        size = ZSTD_getFrameContentSize(src, src_size);
+        if (IN_SET(size, ZSTD_CONTENTSIZE_ERROR, ZSTD_CONTENTSIZE_UNKNOWN))
+                return -EBADMSG;
+
+        /* Decompressed text too short to match the prefix and extra */
+        if (size < prefix_len + 1)
+                return 0;
+
+        if (!(greedy_realloc(buffer, buffer_size, ALIGN_8(prefix_len + 1), 1)))
+                return -ENOMEM;
+
+        dctx = ZSTD_createDCtx();
+        if (!dctx)
+                return -ENOMEM;
+
+        r = zstd_ref_dictionary(dctx, d, src, src_size);
+        if (r < 0)
+                return r;
+
+        /* Only decode as much as we need to compare */
+        output.dst = *buffer;
+        output.size = prefix_len + 1;
+
+        for (;;) {
+                k = ZSTD_decompressStream(dctx, &output, &input);
+                if (ZSTD_isError(k)) {
+                        log_debug("ZSTD decoder failed: %s", ZSTD_getErrorName(k));
+                        return zstd_ret_to_errno(k);
+                }
+                if (output.pos >= output.size)
+                        break;
+                if (k == 0 || input.pos >= input.size)
+                        return -EBADMSG;
+        }
+
+        return memcmp(*buffer, prefix, prefix_len) == 0 &&
+                ((const uint8_t*) *buffer)[prefix_len] == extra;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int decompress_startswith_zstd(const void *src, uint64_t src_size,
+                               void **buffer, size_t *buffer_size,
+                               const void *prefix, size_t prefix_len,
+                               uint8_t extra) {
+        return decompress_startswith_zstd_dictionary(NULL, src, src_size, buffer, buffer_size, prefix, prefix_len, extra);
+}
+
+int decompress_startswith(int compression, const CompressDictionary *d,
                           const void *src, uint64_t src_size,
                           void **buffer, size_t *buffer_size,
                           const void *prefix, size_t prefix_len,
@@ -348,6 +752,11 @@ int decompress_startswith(int compression,
                                                  buffer, buffer_size,
                                                  prefix, prefix_len,
                                                  extra);
+        else if (compression == OBJECT_COMPRESSED_ZSTD)
+                return decompress_startswith_zstd_dictionary(d, src, src_size,
+                                                             buffer, buffer_size,
+                                                             prefix, prefix_len,
+                                                             extra);
         else
                 return -EBADMSG;
 }
@@ -521,6 +930,94 @@ int compress_stream_lz4(int fdf, int fdt, uint64_t max_bytes) {
 #endif
 }
 
+int compress_stream_zstd(int fdf, int fdt, uint64_t max_bytes) {
+
+#if HAVE_ZSTD
+        _cleanup_(ZSTD_freeCCtxp) ZSTD_CCtx *cctx = NULL;
+        _cleanup_free_ void *in_buf = NULL, *out_buf = NULL;
+        size_t in_allocsize, out_allocsize, k;
+        uint64_t total_in = 0, total_out = 0;
+        int r;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        in_allocsize = ZSTD_CStreamInSize();
+        out_allocsize = ZSTD_CStreamOutSize();
+        in_buf = malloc(in_allocsize);
+        out_buf = malloc(out_allocsize);
+        cctx = ZSTD_createCCtx();
+        if (!in_buf || !out_buf || !cctx)
+                return -ENOMEM;
+
+        k = ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+        if (ZSTD_isError(k))
+                log_debug("Failed to enable ZSTD checksum, ignoring: %s", ZSTD_getErrorName(k));
+
+        for (;;) {
+                ZSTD_inBuffer input = {
+                        .src = in_buf,
+                };
+                size_t m = in_allocsize;
+                bool last;
+                ssize_t n;
+
+                if (max_bytes != (uint64_t) -1 && (uint64_t) m > max_bytes)
+                        m = (size_t) max_bytes;
+
+                n = loop_read(fdf, in_buf, m, true);
+                if (n < 0)
+                        return n;
+
+                input.size = n;
+                last = n == 0;
+
+                if (max_bytes != (uint64_t) -1) {
+                        assert(max_bytes >= (uint64_t) n);
+                        max_bytes -= n;
+                }
+
+                total_in += n;
+
+                /* Feed everything we read to the compressor and write out whatever it produces. On the last
+                 * chunk we continue until the frame is complete, which is when zstd returns 0. */
+                for (;;) {
+                        ZSTD_outBuffer output = {
+                                .dst = out_buf,
+                                .size = out_allocsize,
+                        };
+                        size_t remaining;
+
+                        remaining = ZSTD_compressStream2(cctx, &output, &input, last ? ZSTD_e_end : ZSTD_e_continue);
+                        if (ZSTD_isError(remaining)) {
+                                log_debug("ZSTD encoder failed: %s", ZSTD_getErrorName(remaining));
+                                return zstd_ret_to_errno(remaining);
+                        }
+
+                        r = loop_write(fdt, output.dst, output.pos, false);
+                        if (r < 0)
+                                return r;
+
+                        total_out += output.pos;
+
+                        if (last ? remaining == 0 : input.pos == input.size)
+                                break;
+                }
+
+                if (last)
+                        break;
+        }
+
+        log_debug("ZSTD compression finished (%"PRIu64" -> %"PRIu64" bytes, %.1f%%)",
+                  total_in, total_out,
+                  total_in > 0 ? (double) total_out / total_in * 100 : 0.0);
+
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_stream_xz(int fdf, int fdt, uint64_t max_bytes) {
 
 #if HAVE_XZ
@@ -657,12 +1154,95 @@ int decompress_stream_lz4(int in, int out, uint64_t max_bytes) {
 #endif
 }
 
+int decompress_stream_zstd(int fdf, int fdt, uint64_t max_bytes) {
+
+#if HAVE_ZSTD
+        _cleanup_(ZSTD_freeDCtxp) ZSTD_DCtx *dctx = NULL;
+        _cleanup_free_ void *in_buf = NULL, *out_buf = NULL;
+        size_t in_allocsize, out_allocsize, last_result = 0;
+        uint64_t total_in = 0, total_out = 0;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        in_allocsize = ZSTD_DStreamInSize();
+        out_allocsize = ZSTD_DStreamOutSize();
+        in_buf = malloc(in_allocsize);
+        out_buf = malloc(out_allocsize);
+        dctx = ZSTD_createDCtx();
+        if (!in_buf || !out_buf || !dctx)
+                return -ENOMEM;
+
+        for (;;) {
+                ZSTD_inBuffer input = {
+                        .src = in_buf,
+                };
+                ssize_t n;
+
+                n = loop_read(fdf, in_buf, in_allocsize, true);
+                if (n < 0)
+                        return n;
+                if (n == 0)
+                        break;
+
+                input.size = n;
+                total_in += n;
+
+                /* Given a valid frame, zstd won't consume the last byte of the frame until it has flushed
+                 * all of the decompressed data, hence loop until all input is consumed. */
+                while (input.pos < input.size) {
+                        ZSTD_outBuffer output = {
+                                .dst = out_buf,
+                                .size = out_allocsize,
+                        };
+                        ssize_t k;
+
+                        last_result = ZSTD_decompressStream(dctx, &output, &input);
+                        if (ZSTD_isError(last_result)) {
+                                log_debug("ZSTD decoder failed: %s", ZSTD_getErrorName(last_result));
+                                return zstd_ret_to_errno(last_result);
+                        }
+
+                        total_out += output.pos;
+
+                        if (max_bytes != (uint64_t) -1) {
+                                if (max_bytes < output.pos)
+                                        return -EFBIG;
+
+                                max_bytes -= output.pos;
+                        }
+
+                        k = loop_write(fdt, output.dst, output.pos, false);
+                        if (k < 0)
+                                return k;
+                }
+        }
+
+        /* A non-zero result after the input is exhausted means the last frame is incomplete */
+        if (last_result != 0) {
+                log_debug("ZSTD decoder failed: input ended in the middle of a frame");
+                return -EBADMSG;
+        }
+
+        log_debug("ZSTD decompression finished (%"PRIu64" -> %"PRIu64" bytes, %.1f%%)",
+                  total_in, total_out,
+                  total_in > 0 ? (double) total_out / total_in * 100 : 0.0);
+
+        return 0;
+#else
+        log_debug("Cannot decompress file. Compiled without ZSTD support.");
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_stream(const char *filename, int fdf, int fdt, uint64_t max_bytes) {
 
         if (endswith(filename, ".lz4"))
                 return decompress_stream_lz4(fdf, fdt, max_bytes);
         else if (endswith(filename, ".xz"))
                 return decompress_stream_xz(fdf, fdt, max_bytes);
+        else if (endswith(filename, ".zst"))
+                return decompress_stream_zstd(fdf, fdt, max_bytes);
         else
                 return -EPROTONOSUPPORT;
 }
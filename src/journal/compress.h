@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 #pragma once
 
+#include <errno.h>
 #include <unistd.h>
 
 #include "journal-def.h"
@@ -8,31 +9,77 @@
 const char* object_compressed_to_string(int compression);
 int object_compressed_from_string(const char *compression);
 
+/* A zstd dictionary trained on sample blobs, for compressing many small, similar blobs */
+typedef struct CompressDictionary CompressDictionary;
+
+int compress_dictionary_train(const void *samples, const size_t *sample_sizes, unsigned n_samples,
+                              void *dst, size_t dst_alloc_size, size_t *dst_size);
+int compress_dictionary_new(const void *src, size_t src_size, CompressDictionary **ret);
+CompressDictionary* compress_dictionary_free(CompressDictionary *d);
+DEFINE_TRIVIAL_CLEANUP_FUNC(CompressDictionary*, compress_dictionary_free);
+
 int compress_blob_xz(const void *src, uint64_t src_size,
                      void *dst, size_t dst_alloc_size, size_t *dst_size);
 int compress_blob_lz4(const void *src, uint64_t src_size,
                       void *dst, size_t dst_alloc_size, size_t *dst_size);
+int compress_blob_zstd(const void *src, uint64_t src_size,
+                       void *dst, size_t dst_alloc_size, size_t *dst_size);
+int compress_blob_zstd_dictionary(CompressDictionary *d,
+                                  const void *src, uint64_t src_size,
+                                  void *dst, size_t dst_alloc_size, size_t *dst_size);
 
-static inline int compress_blob(const void *src, uint64_t src_size,
-                                void *dst, size_t dst_alloc_size, size_t *dst_size) {
+/* Returns the OBJECT_COMPRESSED_xyz flag of the used compression on success */
+static inline int compress_blob_explicit(int compression,
+                                         const void *src, uint64_t src_size,
+                                         void *dst, size_t dst_alloc_size, size_t *dst_size) {
         int r;
-#if HAVE_LZ4
-        r = compress_blob_lz4(src, src_size, dst, dst_alloc_size, dst_size);
-        if (r == 0)
-                return OBJECT_COMPRESSED_LZ4;
+
+        switch (compression) {
+        case OBJECT_COMPRESSED_ZSTD:
+                r = compress_blob_zstd(src, src_size, dst, dst_alloc_size, dst_size);
+                break;
+        case OBJECT_COMPRESSED_LZ4:
+                r = compress_blob_lz4(src, src_size, dst, dst_alloc_size, dst_size);
+                break;
+        case OBJECT_COMPRESSED_XZ:
+                r = compress_blob_xz(src, src_size, dst, dst_alloc_size, dst_size);
+                break;
+        default:
+                return -EOPNOTSUPP;
+        }
+        if (r < 0)
+                return r;
+
+        return compression;
+}
+
+#if HAVE_ZSTD
+#  define DEFAULT_COMPRESSION OBJECT_COMPRESSED_ZSTD
+#elif HAVE_LZ4
+#  define DEFAULT_COMPRESSION OBJECT_COMPRESSED_LZ4
+#elif HAVE_XZ
+#  define DEFAULT_COMPRESSION OBJECT_COMPRESSED_XZ
 #else
-        r = compress_blob_xz(src, src_size, dst, dst_alloc_size, dst_size);
-        if (r == 0)
-                return OBJECT_COMPRESSED_XZ;
+#  define DEFAULT_COMPRESSION 0
 #endif
-        return r;
+
+static inline int compress_blob(const void *src, uint64_t src_size,
+                                void *dst, size_t dst_alloc_size, size_t *dst_size) {
+        return compress_blob_explicit(DEFAULT_COMPRESSION, src, src_size, dst, dst_alloc_size, dst_size);
 }
 
 int decompress_blob_xz(const void *src, uint64_t src_size,
                        void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
 int decompress_blob_lz4(const void *src, uint64_t src_size,
                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
-int decompress_blob(int compression,
+int decompress_blob_zstd(const void *src, uint64_t src_size,
+                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
+int decompress_blob_zstd_dictionary(const CompressDictionary *d,
+                                    const void *src, uint64_t src_size,
+                                    void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
+
+/* The dictionary is only used for zstd frames that were compressed with one, and may be NULL */
+int decompress_blob(int compression, const CompressDictionary *d,
                     const void *src, uint64_t src_size,
                     void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
 
@@ -44,7 +91,16 @@ int decompress_startswith_lz4(const void *src, uint64_t src_size,
                               void **buffer, size_t *buffer_size,
                               const void *prefix, size_t prefix_len,
                               uint8_t extra);
-int decompress_startswith(int compression,
+int decompress_startswith_zstd(const void *src, uint64_t src_size,
+                               void **buffer, size_t *buffer_size,
+                               const void *prefix, size_t prefix_len,
+                               uint8_t extra);
+int decompress_startswith_zstd_dictionary(const CompressDictionary *d,
+                                          const void *src, uint64_t src_size,
+                                          void **buffer, size_t *buffer_size,
+                                          const void *prefix, size_t prefix_len,
+                                          uint8_t extra);
+int decompress_startswith(int compression, const CompressDictionary *d,
                           const void *src, uint64_t src_size,
                           void **buffer, size_t *buffer_size,
                           const void *prefix, size_t prefix_len,
@@ -52,11 +108,16 @@ int decompress_startswith(int compression,
 
 int compress_stream_xz(int fdf, int fdt, uint64_t max_bytes);
 int compress_stream_lz4(int fdf, int fdt, uint64_t max_bytes);
+int compress_stream_zstd(int fdf, int fdt, uint64_t max_bytes);
 
 int decompress_stream_xz(int fdf, int fdt, uint64_t max_size);
 int decompress_stream_lz4(int fdf, int fdt, uint64_t max_size);
+int decompress_stream_zstd(int fdf, int fdt, uint64_t max_size);
 
-#if HAVE_LZ4
+#if HAVE_ZSTD
+#  define compress_stream compress_stream_zstd
+#  define COMPRESSED_EXT ".zst"
+#elif HAVE_LZ4
 #  define compress_stream compress_stream_lz4
 #  define COMPRESSED_EXT ".lz4"
 #else
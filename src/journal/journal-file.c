@@ -22,6 +22,7 @@
 #include "lookup3.h"
 #include "parse-util.h"
 #include "path-util.h"
+#include "prioq.h"
 #include "random-util.h"
 #include "sd-event.h"
 #include "set.h"
@@ -33,6 +34,11 @@
 #define DEFAULT_DATA_HASH_TABLE_SIZE (2047ULL*sizeof(HashItem))
 #define DEFAULT_FIELD_HASH_TABLE_SIZE (333ULL*sizeof(HashItem))
 
+/* If a hash chain gets longer than this, we suggest rotation, regardless of the fill level of the hash
+ * table. Long chains make every lookup and hence every append of a new data object expensive, and can
+ * occur when the estimated object size the table was sized for doesn't match the actual data. */
+#define HASH_CHAIN_DEPTH_MAX 100
+
 #define DEFAULT_COMPRESS_THRESHOLD (512ULL)
 #define MIN_COMPRESS_THRESHOLD (8ULL)
 
@@ -64,8 +70,12 @@
 /* n_data was the first entry we added after the initial file format design */
 #define HEADER_SIZE_MIN ALIGN64(offsetof(Header, n_data))
 
-/* How many entries to keep in the entry array chain cache at max */
-#define CHAIN_CACHE_MAX 20
+/* How many entries to keep in the entry array chain cache at max. When writing, every entry is linked into
+ * the chains of all of its data objects, so make sure the chains of the commonly used fields fit. */
+#define CHAIN_CACHE_MAX 100
+
+/* How many hashes without data object to remember per archived file at max */
+#define DATA_HASH_MISSES_MAX 256
 
 /* How much to increase the journal file size at once each time we allocate something new. */
 #define FILE_SIZE_INCREASE (8ULL*1024ULL*1024ULL)              /* 8MB */
@@ -73,6 +83,16 @@
 /* Reread fstat() of the file for detecting deletions at least this often */
 #define LAST_STAT_REFRESH_USEC (5*USEC_PER_SEC)
 
+/* Once the dictionary of a file is trained, data objects at least this large are compressed with it */
+#define DICTIONARY_DATA_SIZE_MIN 32
+
+/* The dictionary is trained on the payloads of the first data objects up to this size, once we collected
+ * this much of them */
+#define DICTIONARY_SAMPLE_SIZE_MAX 1024
+#define DICTIONARY_SAMPLES_SIZE (128U*1024U)
+
+#define DICTIONARY_SIZE_MAX (16U*1024U)
+
 /* The mmap context to use for the header we pick as one above the last defined typed */
 #define CONTEXT_HEADER _OBJECT_TYPE_MAX
 
@@ -383,11 +403,16 @@ JournalFile* journal_file_close(JournalFile *f) {
         mmap_cache_unref(f->mmap);
 
         ordered_hashmap_free_free(f->chain_cache);
+        set_free_free(f->data_hash_misses);
 
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_COMPRESSION
         free(f->compress_buffer);
 #endif
 
+        compress_dictionary_free(f->compress_dictionary);
+        free(f->dictionary_samples);
+        free(f->dictionary_sample_sizes);
+
 #if HAVE_GCRYPT
         if (f->fss_file)
                 munmap(f->fss_file, PAGE_ALIGN(f->fss_file_size));
@@ -415,7 +440,9 @@ static int journal_file_init_header(JournalFile *f, JournalFile *template) {
 
         h.incompatible_flags |= htole32(
                 f->compress_xz * HEADER_INCOMPATIBLE_COMPRESSED_XZ |
-                f->compress_lz4 * HEADER_INCOMPATIBLE_COMPRESSED_LZ4);
+                f->compress_lz4 * HEADER_INCOMPATIBLE_COMPRESSED_LZ4 |
+                f->compress_zstd * HEADER_INCOMPATIBLE_COMPRESSED_ZSTD |
+                f->compress_zstd * HEADER_INCOMPATIBLE_COMPRESSED_ZSTD_DICT);
 
         h.compatible_flags = htole32(
                 f->seal * HEADER_COMPATIBLE_SEALED);
@@ -485,7 +512,7 @@ static bool warn_wrong_flags(const JournalFile *f, bool compatible) {
                                   f->path, type, flags & ~any);
                 flags = (flags & any) & ~supported;
                 if (flags) {
-                        const char* strv[3];
+                        const char* strv[5];
                         unsigned n = 0;
                         _cleanup_free_ char *t = NULL;
 
@@ -495,6 +522,10 @@ static bool warn_wrong_flags(const JournalFile *f, bool compatible) {
                                 strv[n++] = "xz-compressed";
                         if (!compatible && (flags & HEADER_INCOMPATIBLE_COMPRESSED_LZ4))
                                 strv[n++] = "lz4-compressed";
+                        if (!compatible && (flags & HEADER_INCOMPATIBLE_COMPRESSED_ZSTD))
+                                strv[n++] = "zstd-compressed";
+                        if (!compatible && (flags & HEADER_INCOMPATIBLE_COMPRESSED_ZSTD_DICT))
+                                strv[n++] = "zstd-dictionary-compressed";
                         strv[n] = NULL;
                         assert(n < ELEMENTSOF(strv));
 
@@ -538,6 +569,11 @@ static int journal_file_verify_header(JournalFile *f) {
         if (JOURNAL_HEADER_SEALED(f->header) && !JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
                 return -EBADMSG;
 
+        /* Dictionaries are only used for zstd compressed files, and are referenced from the header */
+        if (JOURNAL_HEADER_COMPRESSED_ZSTD_DICT(f->header) &&
+            (!JOURNAL_HEADER_COMPRESSED_ZSTD(f->header) || !JOURNAL_HEADER_CONTAINS(f->header, dictionary_offset)))
+                return -EBADMSG;
+
         arena_size = le64toh(f->header->arena_size);
 
         if (UINT64_MAX - header_size < arena_size || header_size + arena_size > (uint64_t) f->last_stat.st_size)
@@ -552,6 +588,10 @@ static int journal_file_verify_header(JournalFile *f) {
             !VALID64(le64toh(f->header->entry_array_offset)))
                 return -ENODATA;
 
+        if (JOURNAL_HEADER_CONTAINS(f->header, dictionary_offset) &&
+            !VALID64(le64toh(f->header->dictionary_offset)))
+                return -ENODATA;
+
         if (f->writable) {
                 sd_id128_t machine_id;
                 uint8_t state;
@@ -590,6 +630,7 @@ static int journal_file_verify_header(JournalFile *f) {
 
         f->compress_xz = JOURNAL_HEADER_COMPRESSED_XZ(f->header);
         f->compress_lz4 = JOURNAL_HEADER_COMPRESSED_LZ4(f->header);
+        f->compress_zstd = JOURNAL_HEADER_COMPRESSED_ZSTD(f->header);
 
         f->seal = JOURNAL_HEADER_SEALED(f->header);
 
@@ -732,6 +773,7 @@ static uint64_t minimum_header_size(Object *o) {
                 [OBJECT_FIELD_HASH_TABLE] = sizeof(HashTableObject),
                 [OBJECT_ENTRY_ARRAY] = sizeof(EntryArrayObject),
                 [OBJECT_TAG] = sizeof(TagObject),
+                [OBJECT_DICTIONARY] = sizeof(DictionaryObject),
         };
 
         if (o->object.type >= ELEMENTSOF(table) || table[o->object.type] <= 0)
@@ -897,6 +939,18 @@ static int journal_file_check_object(JournalFile *f, uint64_t offset, Object *o)
                         return -EBADMSG;
                 }
 
+                break;
+
+        case OBJECT_DICTIONARY:
+                if (le64toh(o->object.size) <= offsetof(DictionaryObject, payload)) {
+                        log_debug(
+                              "Bad dictionary size (<= %zu): %"PRIu64": %"PRIu64,
+                              offsetof(DictionaryObject, payload),
+                              le64toh(o->object.size),
+                              offset);
+                        return -EBADMSG;
+                }
+
                 break;
         }
 
@@ -1264,7 +1318,7 @@ int journal_file_find_field_object_with_hash(
                 const void *field, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t p, osize, h, m;
+        uint64_t p, osize, h, m, depth = 0;
         int r;
 
         assert(f);
@@ -1309,6 +1363,15 @@ int journal_file_find_field_object_with_hash(
                 }
 
                 p = le64toh(o->field.next_hash_offset);
+                if (p > 0) {
+                        depth++;
+
+                        /* Remember the longest chain we walked so far, so that we can suggest rotation */
+                        if (f->writable &&
+                            JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth) &&
+                            depth > le64toh(f->header->field_hash_chain_depth))
+                                f->header->field_hash_chain_depth = htole64(depth);
+                }
         }
 
         return 0;
@@ -1331,12 +1394,42 @@ int journal_file_find_field_object(
                                                         ret, offset);
 }
 
+static bool data_hash_misses_cacheable(JournalFile *f) {
+        assert(f);
+
+        /* Archived files never change, hence what isn't in there now won't ever be. */
+        return !f->writable && f->header->state == STATE_ARCHIVED;
+}
+
+static void data_hash_misses_put(JournalFile *f, uint64_t hash) {
+        uint64_t *k;
+
+        assert(f);
+
+        if (!data_hash_misses_cacheable(f))
+                return;
+
+        if (set_ensure_allocated(&f->data_hash_misses, &uint64_hash_ops) < 0)
+                return;
+
+        if (set_size(f->data_hash_misses) >= DATA_HASH_MISSES_MAX)
+                set_clear_free(f->data_hash_misses);
+
+        k = newdup(uint64_t, &hash, 1);
+        if (!k)
+                return;
+
+        if (set_put(f->data_hash_misses, k) <= 0)
+                free(k);
+}
+
 int journal_file_find_data_object_with_hash(
                 JournalFile *f,
                 const void *data, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t p, osize, h, m;
+        uint64_t p, osize, h, m, depth = 0;
+        bool hash_seen = false;
         int r;
 
         assert(f);
@@ -1347,6 +1440,11 @@ int journal_file_find_data_object_with_hash(
         if (le64toh(f->header->data_hash_table_size) <= 0)
                 return 0;
 
+        /* If we already walked the hash chain before and found nothing with this hash, then there's no
+         * need to fault in the hash table and the chain again. */
+        if (set_contains(f->data_hash_misses, &hash))
+                return 0;
+
         /* Map the data hash table, if it isn't mapped yet. */
         r = journal_file_map_data_hash_table(f);
         if (r < 0)
@@ -1371,8 +1469,10 @@ int journal_file_find_data_object_with_hash(
                 if (le64toh(o->data.hash) != hash)
                         goto next;
 
+                hash_seen = true;
+
                 if (o->object.flags & OBJECT_COMPRESSION_MASK) {
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_COMPRESSION
                         uint64_t l;
                         size_t rsize = 0;
 
@@ -1382,7 +1482,11 @@ int journal_file_find_data_object_with_hash(
 
                         l -= offsetof(Object, data.payload);
 
-                        r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
+                        r = journal_file_load_dictionary(f);
+                        if (r < 0)
+                                return r;
+
+                        r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK, f->compress_dictionary,
                                             o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, 0);
                         if (r < 0)
                                 return r;
@@ -1415,8 +1519,21 @@ int journal_file_find_data_object_with_hash(
 
         next:
                 p = le64toh(o->data.next_hash_offset);
+                if (p > 0) {
+                        depth++;
+
+                        if (f->writable &&
+                            JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth) &&
+                            depth > le64toh(f->header->data_hash_chain_depth))
+                                f->header->data_hash_chain_depth = htole64(depth);
+                }
         }
 
+        /* Only remember the hash if no object has it at all, as it might have collided with the one of
+         * other data. */
+        if (!hash_seen)
+                data_hash_misses_put(f, hash);
+
         return 0;
 }
 
@@ -1499,12 +1616,152 @@ static int journal_file_append_field(
         return 0;
 }
 
-static int journal_file_append_data(
+#if HAVE_COMPRESSION
+static int journal_file_compression(JournalFile *f) {
+        assert(f);
+
+        if (f->compress_zstd)
+                return OBJECT_COMPRESSED_ZSTD;
+        if (f->compress_lz4)
+                return OBJECT_COMPRESSED_LZ4;
+        if (f->compress_xz)
+                return OBJECT_COMPRESSED_XZ;
+
+        return 0;
+}
+#endif
+
+int journal_file_load_dictionary(JournalFile *f) {
+        uint64_t p;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(f->header);
+
+        /* Loads the dictionary data objects of the file may be compressed with, if it has one. Writers only
+         * add it once they saw enough data objects to train it on, hence look again until we found it. */
+
+        if (f->compress_dictionary)
+                return 1;
+
+        if (!JOURNAL_HEADER_COMPRESSED_ZSTD_DICT(f->header))
+                return 0;
+
+        p = le64toh(f->header->dictionary_offset);
+        if (p == 0)
+                return 0;
+
+        r = journal_file_move_to_object(f, OBJECT_DICTIONARY, p, &o);
+        if (r < 0)
+                return r;
+
+        r = compress_dictionary_new(o->dictionary.payload,
+                                    le64toh(o->object.size) - offsetof(Object, dictionary.payload),
+                                    &f->compress_dictionary);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
+static int journal_file_train_dictionary(JournalFile *f) {
+        _cleanup_(compress_dictionary_freep) CompressDictionary *d = NULL;
+        _cleanup_free_ void *buffer = NULL;
+        size_t size, n_samples;
+        uint64_t p;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        buffer = malloc(DICTIONARY_SIZE_MAX);
+        if (!buffer)
+                return -ENOMEM;
+
+        n_samples = f->n_dictionary_samples;
+        r = compress_dictionary_train(f->dictionary_samples, f->dictionary_sample_sizes, n_samples,
+                                      buffer, DICTIONARY_SIZE_MAX, &size);
+        if (r >= 0)
+                r = compress_dictionary_new(buffer, size, &d);
+
+        /* We only get one attempt, either way the samples are not needed anymore */
+        f->dictionary_samples = mfree(f->dictionary_samples);
+        f->dictionary_sample_sizes = mfree(f->dictionary_sample_sizes);
+        f->dictionary_samples_size = f->dictionary_samples_allocated = 0;
+        f->n_dictionary_samples = f->n_dictionary_sample_sizes_allocated = 0;
+
+        if (r < 0) {
+                log_debug_errno(r, "Failed to train compression dictionary for %s, not using one: %m", f->path);
+                f->dictionary_failed = true;
+                return 0;
+        }
+
+        r = journal_file_append_object(f, OBJECT_DICTIONARY, offsetof(Object, dictionary.payload) + size, &o, &p);
+        if (r < 0) {
+                f->dictionary_failed = true;
+                return r;
+        }
+
+        memcpy(o->dictionary.payload, buffer, size);
+
+#if HAVE_GCRYPT
+        r = journal_file_hmac_put_object(f, OBJECT_DICTIONARY, o, p);
+        if (r < 0) {
+                f->dictionary_failed = true;
+                return r;
+        }
+#endif
+
+        f->header->dictionary_offset = htole64(p);
+        f->compress_dictionary = TAKE_PTR(d);
+
+        log_debug("Trained %zu byte compression dictionary for %s on %zu data objects.", size, f->path, n_samples);
+
+        return 0;
+}
+
+static int journal_file_sample_data(JournalFile *f, const void *data, uint64_t size) {
+        int r;
+
+        assert(f);
+        assert(data || size == 0);
+
+        /* Small data objects hardly compress on their own, since they don't repeat much within themselves.
+         * They do repeat a lot across objects though, hence train a dictionary on the first data objects
+         * of the file, and compress all later ones with it. */
+
+        if (!f->writable || f->dictionary_failed || !JOURNAL_HEADER_COMPRESSED_ZSTD_DICT(f->header))
+                return 0;
+
+        r = journal_file_load_dictionary(f);
+        if (r != 0)
+                return r < 0 ? r : 0;
+
+        if (size == 0 || size > DICTIONARY_SAMPLE_SIZE_MAX)
+                return 0;
+
+        if (!GREEDY_REALLOC(f->dictionary_samples, f->dictionary_samples_allocated, f->dictionary_samples_size + size))
+                return -ENOMEM;
+        if (!GREEDY_REALLOC(f->dictionary_sample_sizes, f->n_dictionary_sample_sizes_allocated, f->n_dictionary_samples + 1))
+                return -ENOMEM;
+
+        memcpy(f->dictionary_samples + f->dictionary_samples_size, data, size);
+        f->dictionary_samples_size += size;
+        f->dictionary_sample_sizes[f->n_dictionary_samples++] = size;
+
+        if (f->dictionary_samples_size < DICTIONARY_SAMPLES_SIZE)
+                return 0;
+
+        return journal_file_train_dictionary(f);
+}
+
+static int journal_file_append_data_with_hash(
                 JournalFile *f,
-                const void *data, uint64_t size,
+                const void *data, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t hash, p;
+        uint64_t p;
         uint64_t osize;
         Object *o;
         int r, compression = 0;
@@ -1513,8 +1770,6 @@ static int journal_file_append_data(
         assert(f);
         assert(data || size == 0);
 
-        hash = hash64(data, size);
-
         r = journal_file_find_data_object_with_hash(f, data, size, hash, &o, &p);
         if (r < 0)
                 return r;
@@ -1529,6 +1784,10 @@ static int journal_file_append_data(
                 return 0;
         }
 
+        r = journal_file_sample_data(f, data, size);
+        if (r < 0)
+                return r;
+
         osize = offsetof(Object, data.payload) + size;
         r = journal_file_append_object(f, OBJECT_DATA, osize, &o, &p);
         if (r < 0)
@@ -1536,11 +1795,28 @@ static int journal_file_append_data(
 
         o->data.hash = htole64(hash);
 
-#if HAVE_XZ || HAVE_LZ4
-        if (JOURNAL_FILE_COMPRESS(f) && size >= f->compress_threshold_bytes) {
+#if HAVE_COMPRESSION
+        if (f->compress_dictionary && size >= DICTIONARY_DATA_SIZE_MIN) {
+                size_t rsize = 0;
+
+                /* The dictionary is only ever used with zstd, the header flags make sure of that */
+                r = compress_blob_zstd_dictionary(f->compress_dictionary,
+                                                  data, size, o->data.payload, size - 1, &rsize);
+                if (r >= 0) {
+                        o->object.size = htole64(offsetof(Object, data.payload) + rsize);
+                        o->object.flags |= OBJECT_COMPRESSED_ZSTD;
+                        compression = OBJECT_COMPRESSED_ZSTD;
+
+                        log_debug("Compressed data object %"PRIu64" -> %zu using ZSTD with dictionary",
+                                  size, rsize);
+                }
+
+        } else if (JOURNAL_FILE_COMPRESS(f) && size >= f->compress_threshold_bytes) {
                 size_t rsize = 0;
 
-                compression = compress_blob(data, size, o->data.payload, size - 1, &rsize);
+                /* Use the algorithm the file was created with, which is not necessarily our default */
+                compression = compress_blob_explicit(journal_file_compression(f),
+                                                     data, size, o->data.payload, size - 1, &rsize);
 
                 if (compression >= 0) {
                         o->object.size = htole64(offsetof(Object, data.payload) + rsize);
@@ -1600,6 +1876,17 @@ static int journal_file_append_data(
         return 0;
 }
 
+static int journal_file_append_data(
+                JournalFile *f,
+                const void *data, uint64_t size,
+                Object **ret, uint64_t *offset) {
+
+        assert(f);
+        assert(data || size == 0);
+
+        return journal_file_append_data_with_hash(f, data, size, hash64(data, size), ret, offset);
+}
+
 uint64_t journal_file_entry_n_items(Object *o) {
         assert(o);
 
@@ -1627,78 +1914,192 @@ uint64_t journal_file_hash_table_n_items(Object *o) {
         return (le64toh(o->object.size) - offsetof(Object, hash_table.items)) / sizeof(HashItem);
 }
 
-static int link_entry_into_array(JournalFile *f,
-                                 le64_t *first,
-                                 le64_t *idx,
-                                 uint64_t p) {
+typedef struct ChainCacheItem {
+        uint64_t first; /* the array at the beginning of the chain */
+        uint64_t array; /* the cached array */
+        uint64_t begin; /* the first item in the cached array */
+        uint64_t total; /* the total number of items in all arrays before this one in the chain */
+        uint64_t last_index; /* the last index we looked at, to optimize locality when bisecting */
+} ChainCacheItem;
+
+static void chain_cache_put(
+                OrderedHashmap *h,
+                ChainCacheItem *ci,
+                uint64_t first,
+                uint64_t array,
+                uint64_t begin,
+                uint64_t total,
+                uint64_t last_index) {
+
+        if (!ci) {
+                /* If the chain item to cache for this chain is the
+                 * first one it's not worth caching anything */
+                if (array == first)
+                        return;
+
+                if (ordered_hashmap_size(h) >= CHAIN_CACHE_MAX) {
+                        ci = ordered_hashmap_steal_first(h);
+                        assert(ci);
+                } else {
+                        ci = new(ChainCacheItem, 1);
+                        if (!ci)
+                                return;
+                }
+
+                ci->first = first;
+
+                if (ordered_hashmap_put(h, &ci->first, ci) < 0) {
+                        free(ci);
+                        return;
+                }
+        } else
+                assert(ci->first == first);
+
+        ci->array = array;
+        ci->begin = begin;
+        ci->total = total;
+        ci->last_index = last_index;
+}
+
+static int link_entries_into_array(JournalFile *f,
+                                   le64_t *first,
+                                   le64_t *idx,
+                                   const uint64_t *p,
+                                   size_t n_p) {
         int r;
-        uint64_t n = 0, ap = 0, q, i, a, hidx;
-        Object *o;
+        uint64_t n = 0, ap = 0, q, i, a, hidx, t = 0;
+        ChainCacheItem *ci;
+        Object *o = NULL;
 
         assert(f);
         assert(f->header);
         assert(first);
         assert(idx);
-        assert(p > 0);
+        assert(p);
+        assert(n_p > 0);
 
         a = le64toh(*first);
         i = hidx = le64toh(*idx);
-        while (a > 0) {
+
+        /* Appending always happens at the end of the chain, hence jump to the last array in it we know
+         * of, instead of walking the chain from the start for every entry we link in. */
+        ci = a > 0 ? ordered_hashmap_get(f->chain_cache, &a) : NULL;
+        if (ci && i >= ci->total) {
+                a = ci->array;
+                i -= ci->total;
+                t = ci->total;
+        }
+
+        for (;;) {
+                if (a == 0) {
+                        /* All arrays in the chain are full, append a new one */
+
+                        if (hidx > n)
+                                n = (hidx+1) * 2;
+                        else
+                                n = n * 2;
+
+                        if (n < 4)
+                                n = 4;
+
+                        r = journal_file_append_object(f, OBJECT_ENTRY_ARRAY,
+                                                       offsetof(Object, entry_array.items) + n * sizeof(uint64_t),
+                                                       &o, &q);
+                        if (r < 0)
+                                return r;
+
+#if HAVE_GCRYPT
+                        r = journal_file_hmac_put_object(f, OBJECT_ENTRY_ARRAY, o, q);
+                        if (r < 0)
+                                return r;
+#endif
+
+                        if (ap == 0)
+                                *first = htole64(q);
+                        else {
+                                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, ap, &o);
+                                if (r < 0)
+                                        return r;
+
+                                o->entry_array.next_entry_array_offset = htole64(q);
+                        }
+
+                        if (JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
+                                f->header->n_entry_arrays = htole64(le64toh(f->header->n_entry_arrays) + 1);
+
+                        a = q;
+                }
 
                 r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
                 if (r < 0)
                         return r;
 
+                /* Fill up this array as far as we can */
                 n = journal_file_entry_array_n_items(o);
                 if (i < n) {
-                        o->entry_array.items[i] = htole64(p);
-                        *idx = htole64(hidx + 1);
-                        return 0;
+                        for (; i < n && n_p > 0; i++, p++, n_p--, hidx++)
+                                o->entry_array.items[i] = htole64(*p);
+
+                        *idx = htole64(hidx);
+
+                        if (n_p == 0)
+                                break;
                 }
 
                 i -= n;
+                t += n;
                 ap = a;
                 a = le64toh(o->entry_array.next_entry_array_offset);
         }
 
-        if (hidx > n)
-                n = (hidx+1) * 2;
-        else
-                n = n * 2;
+        chain_cache_put(f->chain_cache, ci, le64toh(*first), a, le64toh(o->entry_array.items[0]), t, (uint64_t) -1);
 
-        if (n < 4)
-                n = 4;
+        return 0;
+}
 
-        r = journal_file_append_object(f, OBJECT_ENTRY_ARRAY,
-                                       offsetof(Object, entry_array.items) + n * sizeof(uint64_t),
-                                       &o, &q);
-        if (r < 0)
-                return r;
+static int link_entry_into_array(JournalFile *f,
+                                 le64_t *first,
+                                 le64_t *idx,
+                                 uint64_t p) {
 
-#if HAVE_GCRYPT
-        r = journal_file_hmac_put_object(f, OBJECT_ENTRY_ARRAY, o, q);
-        if (r < 0)
-                return r;
-#endif
+        assert(p > 0);
+
+        return link_entries_into_array(f, first, idx, &p, 1);
+}
 
-        o->entry_array.items[i] = htole64(p);
+static int link_entries_into_array_plus_one(JournalFile *f,
+                                            le64_t *extra,
+                                            le64_t *first,
+                                            le64_t *idx,
+                                            const uint64_t *p,
+                                            size_t n_p) {
 
-        if (ap == 0)
-                *first = htole64(q);
-        else {
-                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, ap, &o);
-                if (r < 0)
-                        return r;
+        le64_t i;
+        int r;
 
-                o->entry_array.next_entry_array_offset = htole64(q);
-        }
+        assert(f);
+        assert(extra);
+        assert(first);
+        assert(idx);
+        assert(p);
+        assert(n_p > 0);
 
-        if (JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
-                f->header->n_entry_arrays = htole64(le64toh(f->header->n_entry_arrays) + 1);
+        if (*idx == 0) {
+                *extra = htole64(p[0]);
+                *idx = htole64(1);
 
-        *idx = htole64(hidx + 1);
+                p++;
+                n_p--;
 
-        return 0;
+                if (n_p == 0)
+                        return 0;
+        }
+
+        i = htole64(le64toh(*idx) - 1);
+        r = link_entries_into_array(f, first, &i, p, n_p);
+        *idx = htole64(le64toh(i) + 1);
+
+        return r;
 }
 
 static int link_entry_into_array_plus_one(JournalFile *f,
@@ -1707,27 +2108,9 @@ static int link_entry_into_array_plus_one(JournalFile *f,
                                           le64_t *idx,
                                           uint64_t p) {
 
-        int r;
-
-        assert(f);
-        assert(extra);
-        assert(first);
-        assert(idx);
         assert(p > 0);
 
-        if (*idx == 0)
-                *extra = htole64(p);
-        else {
-                le64_t i;
-
-                i = htole64(le64toh(*idx) - 1);
-                r = link_entry_into_array(f, first, &i, p);
-                if (r < 0)
-                        return r;
-        }
-
-        *idx = htole64(le64toh(*idx) + 1);
-        return 0;
+        return link_entries_into_array_plus_one(f, extra, first, idx, &p, 1);
 }
 
 static int journal_file_link_entry_item(JournalFile *f, Object *o, uint64_t offset, uint64_t i) {
@@ -1793,7 +2176,7 @@ static int journal_file_link_entry(JournalFile *f, Object *o, uint64_t offset) {
         return 0;
 }
 
-static int journal_file_append_entry_internal(
+static int journal_file_append_entry_object(
                 JournalFile *f,
                 const dual_timestamp *ts,
                 const sd_id128_t *boot_id,
@@ -1830,6 +2213,28 @@ static int journal_file_append_entry_internal(
                 return r;
 #endif
 
+        *ret = o;
+        *offset = np;
+
+        return 0;
+}
+
+static int journal_file_append_entry_internal(
+                JournalFile *f,
+                const dual_timestamp *ts,
+                const sd_id128_t *boot_id,
+                uint64_t xor_hash,
+                const EntryItem items[], unsigned n_items,
+                uint64_t *seqnum,
+                Object **ret, uint64_t *offset) {
+        uint64_t np;
+        Object *o;
+        int r;
+
+        r = journal_file_append_entry_object(f, ts, boot_id, xor_hash, items, n_items, seqnum, &o, &np);
+        if (r < 0)
+                return r;
+
         r = journal_file_link_entry(f, o, np);
         if (r < 0)
                 return r;
@@ -2016,51 +2421,289 @@ int journal_file_append_entry(
         return r;
 }
 
-typedef struct ChainCacheItem {
-        uint64_t first; /* the array at the beginning of the chain */
-        uint64_t array; /* the cached array */
-        uint64_t begin; /* the first item in the cached array */
-        uint64_t total; /* the total number of items in all arrays before this one in the chain */
-        uint64_t last_index; /* the last index we looked at, to optimize locality when bisecting */
-} ChainCacheItem;
+int journal_batch_add(JournalBatch *b, const dual_timestamp *ts, const struct iovec iovec[], size_t n_iovec) {
+        JournalBatchEntry *e;
+        size_t size = 0, i;
 
-static void chain_cache_put(
-                OrderedHashmap *h,
-                ChainCacheItem *ci,
-                uint64_t first,
-                uint64_t array,
-                uint64_t begin,
-                uint64_t total,
-                uint64_t last_index) {
+        assert(b);
+        assert(iovec || n_iovec == 0);
 
-        if (!ci) {
-                /* If the chain item to cache for this chain is the
-                 * first one it's not worth caching anything */
-                if (array == first)
-                        return;
+        for (i = 0; i < n_iovec; i++)
+                size += iovec[i].iov_len;
 
-                if (ordered_hashmap_size(h) >= CHAIN_CACHE_MAX) {
-                        ci = ordered_hashmap_steal_first(h);
-                        assert(ci);
-                } else {
-                        ci = new(ChainCacheItem, 1);
-                        if (!ci)
-                                return;
+        if (!GREEDY_REALLOC(b->entries, b->n_entries_allocated, b->n_entries + 1))
+                return -ENOMEM;
+        if (n_iovec > 0 && !GREEDY_REALLOC(b->items, b->n_items_allocated, b->n_items + n_iovec))
+                return -ENOMEM;
+        if (size > 0 && !GREEDY_REALLOC(b->data, b->data_allocated, b->data_size + size))
+                return -ENOMEM;
+
+        e = b->entries + b->n_entries++;
+
+        if (ts)
+                e->ts = *ts;
+        else
+                dual_timestamp_get(&e->ts);
+
+        e->first_item = b->n_items;
+        e->n_items = n_iovec;
+        e->size = size;
+
+        for (i = 0; i < n_iovec; i++) {
+                b->items[b->n_items++] = (JournalBatchItem) {
+                        .offset = b->data_size,
+                        .size = iovec[i].iov_len,
+                };
+
+                memcpy_safe(b->data + b->data_size, iovec[i].iov_base, iovec[i].iov_len);
+                b->data_size += iovec[i].iov_len;
+        }
+
+        return 0;
+}
+
+void journal_batch_clear(JournalBatch *b) {
+        assert(b);
+
+        /* Forget about the entries, but keep the memory around for the next batch */
+        b->data_size = 0;
+        b->n_items = 0;
+        b->n_entries = 0;
+        b->n_written = 0;
+}
+
+void journal_batch_done(JournalBatch *b) {
+        assert(b);
+
+        free(b->data);
+        free(b->items);
+        free(b->entries);
+
+        *b = (JournalBatch) {};
+}
+
+typedef struct BatchData {
+        uint64_t hash;
+        const void *data;
+        uint64_t size;
+        uint64_t offset;
+} BatchData;
+
+typedef struct BatchLink {
+        uint64_t data_offset;
+        uint64_t entry_offset;
+} BatchLink;
+
+static int batch_link_cmp(const BatchLink *a, const BatchLink *b) {
+        int r;
+
+        r = CMP(a->data_offset, b->data_offset);
+        if (r != 0)
+                return r;
+
+        return CMP(a->entry_offset, b->entry_offset);
+}
+
+static int journal_file_link_batch(
+                JournalFile *f,
+                const JournalBatchEntry *first, const JournalBatchEntry *last,
+                const uint64_t entry_offsets[], size_t n_entries,
+                BatchLink links[], size_t n_links,
+                uint64_t *buffer) {
+
+        size_t i, j;
+        int r;
+
+        assert(f);
+        assert(f->header);
+        assert(first);
+        assert(last);
+        assert(entry_offsets);
+        assert(n_entries > 0);
+        assert(links || n_links == 0);
+        assert(buffer || n_links == 0);
+
+        __sync_synchronize();
+
+        /* Link up the entries themselves, all in one go */
+        r = link_entries_into_array(f,
+                                    &f->header->entry_array_offset,
+                                    &f->header->n_entries,
+                                    entry_offsets, n_entries);
+        if (r < 0)
+                return r;
+
+        if (f->header->head_entry_realtime == 0)
+                f->header->head_entry_realtime = htole64(first->ts.realtime);
+
+        f->header->tail_entry_realtime = htole64(last->ts.realtime);
+        f->header->tail_entry_monotonic = htole64(last->ts.monotonic);
+
+        /* Link up the items, grouped by data object, so that every data object is looked at, and the tail
+         * of its entry array chain is walked, only once for the whole batch */
+        typesafe_qsort(links, n_links, batch_link_cmp);
+
+        for (i = 0; i < n_links; i = j) {
+                Object *o;
+
+                for (j = i; j < n_links && links[j].data_offset == links[i].data_offset; j++)
+                        buffer[j - i] = links[j].entry_offset;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, links[i].data_offset, &o);
+                if (r < 0)
+                        return r;
+
+                r = link_entries_into_array_plus_one(f,
+                                                     &o->data.entry_offset,
+                                                     &o->data.entry_array_offset,
+                                                     &o->data.n_entries,
+                                                     buffer, j - i);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+int journal_file_append_batch(JournalFile *f, JournalBatch *b, uint64_t *seqnum) {
+        _cleanup_free_ uint64_t *entry_offsets = NULL, *buffer = NULL;
+        _cleanup_free_ BatchLink *links = NULL;
+        _cleanup_free_ BatchData *data = NULL;
+        _cleanup_free_ EntryItem *items = NULL;
+        _cleanup_hashmap_free_ Hashmap *cache = NULL;
+        size_t n_entries = 0, n_links = 0, n_data = 0, n_left, n_items_left, n_items_max = 0, i;
+        const JournalBatchEntry *first;
+        int r = 0, k;
+
+        assert(f);
+        assert(f->header);
+        assert(b);
+
+        /* Appends all entries of the batch that have not been written yet. This is equivalent to calling
+         * journal_file_append_entry() for each of them, but data objects that show up repeatedly in the batch
+         * are looked up only once, the entry array chains are filled up in one go for each of them, and
+         * the change is posted only once at the end. On failure b->n_written points to the entry that
+         * could not be written, all entries before it have been written. */
+
+        if (b->n_written >= b->n_entries)
+                return 0;
+
+        first = b->entries + b->n_written;
+        n_left = b->n_entries - b->n_written;
+        n_items_left = b->n_items - first->first_item;
+
+        for (i = b->n_written; i < b->n_entries; i++)
+                n_items_max = MAX(n_items_max, b->entries[i].n_items);
+
+        entry_offsets = new(uint64_t, n_left);
+        links = new(BatchLink, MAX(1u, n_items_left));
+        buffer = new(uint64_t, MAX(1u, n_items_left));
+        data = new(BatchData, MAX(1u, n_items_left));
+        items = new(EntryItem, MAX(1u, n_items_max));
+        cache = hashmap_new(&uint64_hash_ops);
+        if (!entry_offsets || !links || !buffer || !data || !items || !cache)
+                return -ENOMEM;
+
+        for (; b->n_written < b->n_entries; b->n_written++) {
+                const JournalBatchEntry *e = b->entries + b->n_written;
+                uint64_t xor_hash = 0, np;
+                Object *o;
+
+                if (!VALID_REALTIME(e->ts.realtime)) {
+                        log_debug("Invalid realtime timestamp %"PRIu64", refusing entry.", e->ts.realtime);
+                        r = -EBADMSG;
+                        break;
+                }
+                if (!VALID_MONOTONIC(e->ts.monotonic)) {
+                        log_debug("Invalid monotomic timestamp %"PRIu64", refusing entry.", e->ts.monotonic);
+                        r = -EBADMSG;
+                        break;
                 }
 
-                ci->first = first;
+#if HAVE_GCRYPT
+                r = journal_file_maybe_append_tag(f, e->ts.realtime);
+                if (r < 0)
+                        break;
+#endif
 
-                if (ordered_hashmap_put(h, &ci->first, ci) < 0) {
-                        free(ci);
-                        return;
+                for (i = 0; i < e->n_items; i++) {
+                        const JournalBatchItem *item = b->items + e->first_item + i;
+                        const void *d = b->data + item->offset;
+                        uint64_t h, p;
+                        BatchData *c;
+
+                        h = hash64(d, item->size);
+
+                        c = hashmap_get(cache, &h);
+                        if (c && c->size == item->size && memcmp_safe(c->data, d, item->size) == 0)
+                                p = c->offset;
+                        else {
+                                r = journal_file_append_data_with_hash(f, d, item->size, h, NULL, &p);
+                                if (r < 0)
+                                        break;
+
+                                if (!c) {
+                                        c = data + n_data++;
+                                        *c = (BatchData) {
+                                                .hash = h,
+                                                .data = d,
+                                                .size = item->size,
+                                                .offset = p,
+                                        };
+
+                                        /* This is just a cache, hence ignore failure */
+                                        (void) hashmap_put(cache, &c->hash, c);
+                                }
+                        }
+
+                        xor_hash ^= h;
+                        items[i].object_offset = htole64(p);
+                        items[i].hash = htole64(h);
                 }
-        } else
-                assert(ci->first == first);
+                if (r < 0)
+                        break;
 
-        ci->array = array;
-        ci->begin = begin;
-        ci->total = total;
-        ci->last_index = last_index;
+                /* Order by the position on disk, in order to improve seek
+                 * times for rotating media. */
+                typesafe_qsort(items, e->n_items, entry_item_cmp);
+
+                r = journal_file_append_entry_object(f, &e->ts, NULL, xor_hash, items, e->n_items, seqnum, &o, &np);
+                if (r < 0)
+                        break;
+
+                entry_offsets[n_entries++] = np;
+
+                for (i = 0; i < e->n_items; i++)
+                        links[n_links++] = (BatchLink) {
+                                .data_offset = le64toh(items[i].object_offset),
+                                .entry_offset = np,
+                        };
+        }
+
+        /* Link up whatever we managed to append, even if we failed on the way */
+        if (n_entries > 0) {
+                k = journal_file_link_batch(f, first, b->entries + b->n_written - 1,
+                                            entry_offsets, n_entries,
+                                            links, n_links,
+                                            buffer);
+                if (k < 0 && r >= 0)
+                        r = k;
+        }
+
+        /* If the memory mapping triggered a SIGBUS then we return an
+         * IO error and ignore the error code passed down to us, since
+         * it is very likely just an effect of a nullified replacement
+         * mapping page */
+
+        if (mmap_cache_got_sigbus(f->mmap, f->cache_fd))
+                r = -EIO;
+
+        if (f->post_change_timer)
+                schedule_post_change(f);
+        else
+                journal_file_post_change(f);
+
+        return r;
 }
 
 static int generic_array_get(
@@ -3053,6 +3696,10 @@ void journal_file_dump(JournalFile *f) {
                                le64toh(o->tag.epoch));
                         break;
 
+                case OBJECT_DICTIONARY:
+                        printf("Type: OBJECT_DICTIONARY\n");
+                        break;
+
                 default:
                         printf("Type: unknown (%i)\n", o->object.type);
                         break;
@@ -3098,7 +3745,7 @@ void journal_file_print_header(JournalFile *f) {
                "Sequential Number ID: %s\n"
                "State: %s\n"
                "Compatible Flags:%s%s\n"
-               "Incompatible Flags:%s%s%s\n"
+               "Incompatible Flags:%s%s%s%s%s\n"
                "Header size: %"PRIu64"\n"
                "Arena size: %"PRIu64"\n"
                "Data Hash Table Size: %"PRIu64"\n"
@@ -3123,6 +3770,8 @@ void journal_file_print_header(JournalFile *f) {
                (le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_ANY) ? " ???" : "",
                JOURNAL_HEADER_COMPRESSED_XZ(f->header) ? " COMPRESSED-XZ" : "",
                JOURNAL_HEADER_COMPRESSED_LZ4(f->header) ? " COMPRESSED-LZ4" : "",
+               JOURNAL_HEADER_COMPRESSED_ZSTD(f->header) ? " COMPRESSED-ZSTD" : "",
+               JOURNAL_HEADER_COMPRESSED_ZSTD_DICT(f->header) ? " COMPRESSED-ZSTD-DICT" : "",
                (le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_ANY) ? " ???" : "",
                le64toh(f->header->header_size),
                le64toh(f->header->arena_size),
@@ -3156,6 +3805,19 @@ void journal_file_print_header(JournalFile *f) {
                 printf("Entry Array Objects: %"PRIu64"\n",
                        le64toh(f->header->n_entry_arrays));
 
+        if (JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth))
+                printf("Deepest Field Hash Chain: %"PRIu64"\n",
+                       le64toh(f->header->field_hash_chain_depth));
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth))
+                printf("Deepest Data Hash Chain: %"PRIu64"\n",
+                       le64toh(f->header->data_hash_chain_depth));
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, dictionary_offset) &&
+            le64toh(f->header->dictionary_offset) != 0)
+                printf("Compression Dictionary Offset: %"PRIu64"\n",
+                       le64toh(f->header->dictionary_offset));
+
         if (fstat(f->fd, &st) >= 0)
                 printf("Disk usage: %s\n", format_bytes(bytes, sizeof(bytes), (uint64_t) st.st_blocks * 512ULL));
 }
@@ -3235,8 +3897,11 @@ int journal_file_open(
                 .flags = flags,
                 .prot = prot_from_flags(flags),
                 .writable = (flags & O_ACCMODE) != O_RDONLY,
+                .location_prioq_idx = PRIOQ_IDX_NULL,
 
-#if HAVE_LZ4
+#if HAVE_ZSTD
+                .compress_zstd = compress,
+#elif HAVE_LZ4
                 .compress_lz4 = compress,
 #elif HAVE_XZ
                 .compress_xz = compress,
@@ -3675,10 +4340,14 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                         return -E2BIG;
 
                 if (o->object.flags & OBJECT_COMPRESSION_MASK) {
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_COMPRESSION
                         size_t rsize = 0;
 
-                        r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
+                        r = journal_file_load_dictionary(from);
+                        if (r < 0)
+                                return r;
+
+                        r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK, from->compress_dictionary,
                                             o->data.payload, l, &from->compress_buffer, &from->compress_buffer_size, &rsize, 0);
                         if (r < 0)
                                 return r;
@@ -3923,6 +4592,23 @@ bool journal_file_rotate_suggested(JournalFile *f, usec_t max_file_usec) {
                         return true;
                 }
 
+        /* If the hash chains got too long, lookups get expensive even if the overall fill level is still
+         * fine, for example because many items collide or because the hash table was sized for a different
+         * kind of data. Start a new file, with fresh hash tables, in that case. */
+        if (JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth) &&
+            le64toh(f->header->data_hash_chain_depth) > HASH_CHAIN_DEPTH_MAX) {
+                log_debug("Data hash table of %s has deepest hash chain of length %"PRIu64", suggesting rotation.",
+                          f->path, le64toh(f->header->data_hash_chain_depth));
+                return true;
+        }
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth) &&
+            le64toh(f->header->field_hash_chain_depth) > HASH_CHAIN_DEPTH_MAX) {
+                log_debug("Field hash table of %s has deepest hash chain of length %"PRIu64", suggesting rotation.",
+                          f->path, le64toh(f->header->field_hash_chain_depth));
+                return true;
+        }
+
         /* Are the data objects properly indexed by field objects? */
         if (JOURNAL_HEADER_CONTAINS(f->header, n_data) &&
             JOURNAL_HEADER_CONTAINS(f->header, n_fields) &&
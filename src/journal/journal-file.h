@@ -9,6 +9,7 @@
 
 #include "sd-id128.h"
 
+#include "compress.h"
 #include "hashmap.h"
 #include "journal-def.h"
 #include "macro.h"
@@ -66,6 +67,7 @@ typedef struct JournalFile {
         bool writable:1;
         bool compress_xz:1;
         bool compress_lz4:1;
+        bool compress_zstd:1;
         bool seal:1;
         bool defrag_on_close:1;
         bool close_fd:1;
@@ -74,6 +76,7 @@ typedef struct JournalFile {
         direction_t last_direction;
         LocationType location_type;
         uint64_t last_n_entries;
+        unsigned location_prioq_idx;
 
         char *path;
         struct stat last_stat;
@@ -98,17 +101,30 @@ typedef struct JournalFile {
 
         OrderedHashmap *chain_cache;
 
+        /* Hashes of data objects that are known not to be in an archived file, since matches look them up
+         * over and over again. */
+        Set *data_hash_misses;
+
         pthread_t offline_thread;
         volatile OfflineState offline_state;
 
         unsigned last_seen_generation;
 
         uint64_t compress_threshold_bytes;
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_COMPRESSION
         void *compress_buffer;
         size_t compress_buffer_size;
 #endif
 
+        /* The dictionary small data objects are compressed with. Until it is trained, writers collect the
+         * payloads of the first data objects as samples for it. */
+        CompressDictionary *compress_dictionary;
+        bool dictionary_failed;
+        uint8_t *dictionary_samples;
+        size_t dictionary_samples_size, dictionary_samples_allocated;
+        size_t *dictionary_sample_sizes;
+        size_t n_dictionary_samples, n_dictionary_sample_sizes_allocated;
+
 #if HAVE_GCRYPT
         gcry_md_hd_t hmac;
         bool hmac_running;
@@ -192,6 +208,12 @@ static inline bool VALID_EPOCH(uint64_t u) {
 #define JOURNAL_HEADER_COMPRESSED_LZ4(h) \
         (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_LZ4))
 
+#define JOURNAL_HEADER_COMPRESSED_ZSTD(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_ZSTD))
+
+#define JOURNAL_HEADER_COMPRESSED_ZSTD_DICT(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_ZSTD_DICT))
+
 int journal_file_move_to_object(JournalFile *f, ObjectType type, uint64_t offset, Object **ret);
 
 uint64_t journal_file_entry_n_items(Object *o) _pure_;
@@ -208,12 +230,48 @@ int journal_file_append_entry(
                 Object **ret,
                 uint64_t *offset);
 
+/* A batch of entries to append with journal_file_append_batch(). The batch keeps copies of the entry
+ * payloads, so that they may be collected from buffers that are reused for the next entry. */
+typedef struct JournalBatchItem {
+        size_t offset;
+        size_t size;
+} JournalBatchItem;
+
+typedef struct JournalBatchEntry {
+        dual_timestamp ts;
+        size_t first_item;
+        size_t n_items;
+        size_t size;
+} JournalBatchEntry;
+
+typedef struct JournalBatch {
+        uint8_t *data;
+        size_t data_size, data_allocated;
+
+        JournalBatchItem *items;
+        size_t n_items, n_items_allocated;
+
+        JournalBatchEntry *entries;
+        size_t n_entries, n_entries_allocated;
+
+        /* The entries before this one have been processed already */
+        size_t n_written;
+} JournalBatch;
+
+int journal_batch_add(JournalBatch *b, const dual_timestamp *ts, const struct iovec iovec[], size_t n_iovec);
+void journal_batch_clear(JournalBatch *b);
+void journal_batch_done(JournalBatch *b);
+
+int journal_file_append_batch(JournalFile *f, JournalBatch *b, uint64_t *seqno);
+
 int journal_file_find_data_object(JournalFile *f, const void *data, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_find_data_object_with_hash(JournalFile *f, const void *data, uint64_t size, uint64_t hash, Object **ret, uint64_t *offset);
 
 int journal_file_find_field_object(JournalFile *f, const void *field, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_find_field_object_with_hash(JournalFile *f, const void *field, uint64_t size, uint64_t hash, Object **ret, uint64_t *offset);
 
+int journal_file_load_dictionary(JournalFile *f);
+
 void journal_file_reset_location(JournalFile *f);
 void journal_file_save_location(JournalFile *f, Object *o, uint64_t offset);
 int journal_file_compare_locations(JournalFile *af, JournalFile *bf);
@@ -241,6 +299,9 @@ int journal_file_rotate(JournalFile **f, bool compress, uint64_t compress_thresh
 
 int journal_file_dispose(int dir_fd, const char *fname);
 
+/* The period to insert between posting changes for coalescing */
+#define POST_CHANGE_TIMER_INTERVAL_USEC (250*USEC_PER_MSEC)
+
 void journal_file_post_change(JournalFile *f);
 int journal_file_enable_post_change_timer(JournalFile *f, sd_event *e, usec_t t);
 
@@ -257,5 +318,5 @@ int journal_file_map_field_hash_table(JournalFile *f);
 
 static inline bool JOURNAL_FILE_COMPRESS(JournalFile *f) {
         assert(f);
-        return f->compress_xz || f->compress_lz4;
+        return f->compress_xz || f->compress_lz4 || f->compress_zstd;
 }
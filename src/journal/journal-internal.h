@@ -12,6 +12,7 @@
 #include "journal-def.h"
 #include "journal-file.h"
 #include "list.h"
+#include "prioq.h"
 #include "set.h"
 
 typedef struct Match Match;
@@ -72,6 +73,12 @@ struct sd_journal {
 
         OrderedHashmap *files;
         IteratedCache *files_cache;
+
+        /* Files with a candidate entry for the next iteration step, ordered by that entry, and the files
+         * that were not archived when the queue was built and hence may still grow. */
+        Prioq *files_prioq;
+        direction_t files_prioq_direction;
+        Set *files_growing;
         MMapCache *mmap;
 
         Location current_location;
@@ -24,6 +24,11 @@
 
 #define SNDBUF_SIZE (8*1024*1024)
 
+static const union sockaddr_union journal_sa = {
+        .un.sun_family = AF_UNIX,
+        .un.sun_path = "/run/systemd/journal/socket",
+};
+
 #define ALLOCA_CODE_FUNC(f, func)                 \
         do {                                      \
                 size_t _fl;                       \
@@ -54,6 +59,10 @@ retry:
 
         fd_inc_sndbuf(fd, SNDBUF_SIZE);
 
+        /* Connect right away, so that the socket path doesn't have to be looked up again for every single
+         * message. If journald is not running yet, this fails, and we'll try again when sending. */
+        (void) connect(fd, &journal_sa.sa, SOCKADDR_UN_LEN(journal_sa.un));
+
         if (!__sync_bool_compare_and_swap(&fd_plus_one, 0, fd+1)) {
                 safe_close(fd);
                 goto retry;
@@ -199,14 +208,7 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
         struct iovec *w;
         uint64_t *l;
         int i, j = 0;
-        static const union sockaddr_union sa = {
-                .un.sun_family = AF_UNIX,
-                .un.sun_path = "/run/systemd/journal/socket",
-        };
-        struct msghdr mh = {
-                .msg_name = (struct sockaddr*) &sa.sa,
-                .msg_namelen = SOCKADDR_UN_LEN(sa.un),
-        };
+        struct msghdr mh = {};
         ssize_t k;
         bool have_syslog_identifier = false;
         bool seal = true;
@@ -278,6 +280,16 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
         mh.msg_iovlen = j;
 
         k = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        if (k < 0 && IN_SET(errno, ENOTCONN, ECONNREFUSED)) {
+                /* journald wasn't running when we connected, or was restarted since. Connect to the current
+                 * instance, and retry, passing the address explicitly in case that failed. */
+                (void) connect(fd, &journal_sa.sa, SOCKADDR_UN_LEN(journal_sa.un));
+
+                mh.msg_name = (struct sockaddr*) &journal_sa.sa;
+                mh.msg_namelen = SOCKADDR_UN_LEN(journal_sa.un);
+
+                k = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        }
         if (k >= 0)
                 return 0;
 
@@ -318,7 +330,7 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
                         return r;
         }
 
-        r = send_one_fd_sa(fd, buffer_fd, mh.msg_name, mh.msg_namelen, 0);
+        r = send_one_fd_sa(fd, buffer_fd, &journal_sa.sa, SOCKADDR_UN_LEN(journal_sa.un), 0);
         if (r == -ENOENT)
                 /* Fail silently if the journal is not available */
                 return 0;
@@ -90,6 +90,12 @@ static int pattern_compile(const char *pattern, unsigned flags, pcre2_code **out
                 return -EINVAL;
         }
 
+        /* The pattern is matched against every message we look at, so have it compiled to machine code if
+         * the library supports that. If it doesn't, pcre2_match() falls back to the interpreter. */
+        r = pcre2_jit_compile(p, PCRE2_JIT_COMPLETE);
+        if (r < 0)
+                log_debug("JIT compilation of pattern \"%s\" not available, ignoring: %i", pattern, r);
+
         *out = p;
         return 0;
 }
@@ -2078,6 +2084,9 @@ int main(int argc, char *argv[]) {
         _cleanup_(sd_journal_closep) sd_journal *j = NULL;
         sd_id128_t previous_boot_id;
         int n_shown = 0, r, poll_fd = -1;
+#if HAVE_PCRE2
+        _cleanup_(pcre2_match_data_freep) pcre2_match_data *md = NULL;
+#endif
 
         setlocale(LC_ALL, "");
         log_parse_environment();
@@ -2572,14 +2581,15 @@ int main(int argc, char *argv[]) {
 
 #if HAVE_PCRE2
                         if (arg_compiled_pattern) {
-                                _cleanup_(pcre2_match_data_freep) pcre2_match_data *md = NULL;
                                 const void *message;
                                 size_t len;
                                 PCRE2_SIZE *ovec;
 
-                                md = pcre2_match_data_create(1, NULL);
-                                if (!md)
-                                        return log_oom();
+                                if (!md) {
+                                        md = pcre2_match_data_create(1, NULL);
+                                        if (!md)
+                                                return log_oom();
+                                }
 
                                 r = sd_journal_get_data(j, "MESSAGE", &message, &len);
                                 if (r < 0) {
@@ -1,5 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
+#include <sys/inotify.h>
+
 #if HAVE_SELINUX
 #include <selinux/selinux.h>
 #endif
@@ -16,6 +18,7 @@
 #include "parse-util.h"
 #include "process-util.h"
 #include "string-util.h"
+#include "strv.h"
 #include "syslog-util.h"
 #include "unaligned.h"
 #include "user-util.h"
@@ -31,6 +34,11 @@
  * refreshed in an incremental way (meaning: data is reread from /proc, but any old data we can't refresh is not
  * flushed out). Data newer than 1s is used immediately without refresh.
  *
+ * The per-unit data PID 1 stores in /run/systemd/units/ (invocation ID, maximum log level, extra fields, rate limit
+ * settings) is not reread on such a refresh unless the unit of the client changed, or something in that directory
+ * changed since we read it last, which we learn about through inotify. Only if the directory cannot be watched the
+ * data is reread on every refresh.
+ *
  * Log stream clients (i.e. all clients using the AF_UNIX/SOCK_STREAM stdout/stderr transport) will pin a cache entry
  * as long as their socket is connected. Note that cache entries are shared between different transports. That means a
  * cache entry pinned for the stream connection logic may be reused for the syslog or native protocols.
@@ -116,6 +124,14 @@ static int client_context_new(Server *s, pid_t pid, ClientContext **ret) {
         return 0;
 }
 
+static void client_context_flush_fields(ClientContext *c) {
+        assert(c);
+
+        c->fields = strv_free(c->fields);
+        c->fields_iovec = mfree(c->fields_iovec);
+        c->fields_n_iovec = 0;
+}
+
 static void client_context_reset(Server *s, ClientContext *c) {
         assert(s);
         assert(c);
@@ -155,6 +171,10 @@ static void client_context_reset(Server *s, ClientContext *c) {
 
         c->log_rate_limit_interval = s->rate_limit_interval;
         c->log_rate_limit_burst = s->rate_limit_burst;
+
+        c->units_generation = 0;
+
+        client_context_flush_fields(c);
 }
 
 static ClientContext* client_context_free(Server *s, ClientContext *c) {
@@ -257,8 +277,10 @@ static int client_context_read_cgroup(Server *s, ClientContext *c, const char *u
                 /* If that didn't work, we use the unit ID passed in as fallback, if we have nothing cached yet */
                 if (unit_id && !c->unit) {
                         c->unit = strdup(unit_id);
-                        if (c->unit)
+                        if (c->unit) {
+                                c->units_generation = 0;
                                 return 0;
+                        }
                 }
 
                 return r;
@@ -290,6 +312,9 @@ static int client_context_read_cgroup(Server *s, ClientContext *c, const char *u
         (void) cg_path_get_user_slice(c->cgroup, &t);
         free_and_replace(c->user_slice, t);
 
+        /* The unit might have changed, hence reread its data from /run/systemd/units/ */
+        c->units_generation = 0;
+
         return 0;
 }
 
@@ -482,6 +507,8 @@ static void client_context_really_refresh(
         if (timestamp == USEC_INFINITY)
                 timestamp = now(CLOCK_MONOTONIC);
 
+        client_context_flush_fields(c);
+
         client_context_read_uid_gid(c, ucred);
         client_context_read_basic(c);
         (void) client_context_read_label(c, label, label_size);
@@ -490,13 +517,19 @@ static void client_context_really_refresh(
         (void) audit_loginuid_from_pid(c->pid, &c->loginuid);
 
         (void) client_context_read_cgroup(s, c, unit_id);
-        (void) client_context_read_invocation_id(s, c);
-        (void) client_context_read_log_level_max(s, c);
-        (void) client_context_read_extra_fields(s, c);
-        (void) client_context_read_log_rate_limit_interval(c);
-        (void) client_context_read_log_rate_limit_burst(c);
+
+        if (s->units_generation == 0 || c->units_generation != s->units_generation) {
+                (void) client_context_read_invocation_id(s, c);
+                (void) client_context_read_log_level_max(s, c);
+                (void) client_context_read_extra_fields(s, c);
+                (void) client_context_read_log_rate_limit_interval(c);
+                (void) client_context_read_log_rate_limit_burst(c);
+
+                c->units_generation = s->units_generation;
+        }
 
         c->timestamp = timestamp;
+        s->n_client_context_refreshes++;
 
         if (c->in_lru) {
                 assert(c->n_ref == 0);
@@ -543,12 +576,96 @@ void client_context_maybe_refresh(
         if (label_size > 0 && (label_size != c->label_size || memcmp(label, c->label, label_size) != 0))
                 goto refresh;
 
+        s->n_client_context_hits++;
         return;
 
 refresh:
         client_context_really_refresh(s, c, ucred, label, label_size, unit_id, timestamp);
 }
 
+#define FIELDS_ADD_NUMERIC(l, value, isset, format, field)              \
+        if (isset(value) && strv_extendf(&l, field "=" format, value) < 0) \
+                return -ENOMEM;
+
+#define FIELDS_ADD_STRING(l, value, field)                              \
+        if (!isempty(value) && strv_extendf(&l, field "=%s", value) < 0) \
+                return -ENOMEM;
+
+#define FIELDS_ADD_ID128(l, value, field)                               \
+        if (!sd_id128_is_null(value) &&                                 \
+            strv_extendf(&l, field "=" SD_ID128_FORMAT_STR, SD_ID128_FORMAT_VAL(value)) < 0) \
+                return -ENOMEM;
+
+#define FIELDS_ADD_SIZED(l, value, value_size, field)                   \
+        if (value_size > 0 && strv_extendf(&l, field "=%.*s", (int) value_size, value) < 0) \
+                return -ENOMEM;
+
+int client_context_get_fields(ClientContext *c, const struct iovec **ret, size_t *ret_n) {
+        _cleanup_strv_free_ char **l = NULL;
+        struct iovec *iovec;
+        size_t n = 0;
+        char **i;
+
+        assert(c);
+        assert(ret);
+        assert(ret_n);
+
+        /* Returns the trusted fields describing the client. These only change when the context is refreshed, hence
+         * format them once, and reuse them for all messages until then. */
+
+        if (c->fields) {
+                *ret = c->fields_iovec;
+                *ret_n = c->fields_n_iovec;
+                return 0;
+        }
+
+        FIELDS_ADD_NUMERIC(l, c->pid, pid_is_valid, PID_FMT, "_PID");
+        FIELDS_ADD_NUMERIC(l, c->uid, uid_is_valid, UID_FMT, "_UID");
+        FIELDS_ADD_NUMERIC(l, c->gid, gid_is_valid, GID_FMT, "_GID");
+
+        FIELDS_ADD_STRING(l, c->comm, "_COMM");
+        FIELDS_ADD_STRING(l, c->exe, "_EXE");
+        FIELDS_ADD_STRING(l, c->cmdline, "_CMDLINE");
+        FIELDS_ADD_STRING(l, c->capeff, "_CAP_EFFECTIVE");
+
+        FIELDS_ADD_SIZED(l, c->label, c->label_size, "_SELINUX_CONTEXT");
+
+        FIELDS_ADD_NUMERIC(l, c->auditid, audit_session_is_valid, "%" PRIu32, "_AUDIT_SESSION");
+        FIELDS_ADD_NUMERIC(l, c->loginuid, uid_is_valid, UID_FMT, "_AUDIT_LOGINUID");
+
+        FIELDS_ADD_STRING(l, c->cgroup, "_SYSTEMD_CGROUP");
+        FIELDS_ADD_STRING(l, c->session, "_SYSTEMD_SESSION");
+        FIELDS_ADD_NUMERIC(l, c->owner_uid, uid_is_valid, UID_FMT, "_SYSTEMD_OWNER_UID");
+        FIELDS_ADD_STRING(l, c->unit, "_SYSTEMD_UNIT");
+        FIELDS_ADD_STRING(l, c->user_unit, "_SYSTEMD_USER_UNIT");
+        FIELDS_ADD_STRING(l, c->slice, "_SYSTEMD_SLICE");
+        FIELDS_ADD_STRING(l, c->user_slice, "_SYSTEMD_USER_SLICE");
+
+        FIELDS_ADD_ID128(l, c->invocation_id, "_SYSTEMD_INVOCATION_ID");
+
+        if (!l) {
+                /* Make sure we remember that there's nothing to add */
+                l = new0(char*, 1);
+                if (!l)
+                        return -ENOMEM;
+        }
+
+        iovec = new(struct iovec, strv_length(l));
+        if (!iovec)
+                return -ENOMEM;
+
+        STRV_FOREACH(i, l)
+                iovec[n++] = IOVEC_MAKE_STRING(*i);
+
+        c->fields = TAKE_PTR(l);
+        c->fields_iovec = iovec;
+        c->fields_n_iovec = n;
+
+        *ret = c->fields_iovec;
+        *ret_n = c->fields_n_iovec;
+        return 0;
+}
+
 static void client_context_try_shrink_to(Server *s, size_t limit) {
         assert(s);
 
@@ -587,6 +704,54 @@ void client_context_flush_all(Server *s) {
 
         s->client_contexts_lru = prioq_free(s->client_contexts_lru);
         s->client_contexts = hashmap_free(s->client_contexts);
+
+        log_debug("Client metadata cache: %u hits, %u misses, %u refreshes.",
+                  s->n_client_context_hits, s->n_client_context_misses, s->n_client_context_refreshes);
+}
+
+static int dispatch_units_change(sd_event_source *es, const struct inotify_event *event, void *userdata) {
+        Server *s = userdata;
+
+        assert(s);
+        assert(event);
+
+        if (event->mask & IN_IGNORED) {
+                /* The directory is gone, we can't know anymore when to reread the data, hence always do */
+                log_debug("/run/systemd/units/ vanished, no longer watching it.");
+                s->units_generation = 0;
+                return sd_event_source_set_enabled(es, SD_EVENT_OFF);
+        }
+
+        /* Something changed, or the inotify queue overflowed. Either way, all cached unit data is potentially out of
+         * date now. */
+        s->units_generation++;
+        return 0;
+}
+
+int client_context_watch_units(Server *s) {
+        int r;
+
+        assert(s);
+        assert(!s->units_event_source);
+
+        /* PID 1 updates the files in /run/systemd/units/ exclusively by atomically renaming new versions into place
+         * and by removing them, hence watching for that suffices. */
+        r = sd_event_add_inotify(s->event, &s->units_event_source, "/run/systemd/units",
+                                 IN_MOVED_TO|IN_MOVED_FROM|IN_DELETE|IN_ONLYDIR,
+                                 dispatch_units_change, s);
+        if (r < 0)
+                return log_debug_errno(r, "Failed to watch /run/systemd/units/, rereading unit data on every refresh: %m");
+
+        /* Process changes before any log messages, so that the data is up-to-date for messages logged after the
+         * change */
+        r = sd_event_source_set_priority(s->units_event_source, SD_EVENT_PRIORITY_IMPORTANT-10);
+        if (r < 0) {
+                s->units_event_source = sd_event_source_unref(s->units_event_source);
+                return log_error_errno(r, "Failed to adjust priority of unit data event source: %m");
+        }
+
+        s->units_generation = 1;
+        return 0;
 }
 
 static int client_context_get_internal(
@@ -610,16 +775,8 @@ static int client_context_get_internal(
         c = hashmap_get(s->client_contexts, PID_TO_PTR(pid));
         if (c) {
 
-                if (add_ref) {
-                        if (c->in_lru) {
-                                /* The entry wasn't pinned so far, let's remove it from the LRU list then */
-                                assert(c->n_ref == 0);
-                                assert_se(prioq_remove(s->client_contexts_lru, c, &c->lru_index) >= 0);
-                                c->in_lru = false;
-                        }
-
-                        c->n_ref++;
-                }
+                if (add_ref)
+                        client_context_pin(s, c);
 
                 client_context_maybe_refresh(s, c, ucred, label, label_len, unit_id, USEC_INFINITY);
 
@@ -627,6 +784,8 @@ static int client_context_get_internal(
                 return 0;
         }
 
+        s->n_client_context_misses++;
+
         client_context_try_shrink_to(s, CACHE_MAX-1);
 
         r = client_context_new(s, pid, &c);
@@ -673,6 +832,24 @@ int client_context_acquire(
         return client_context_get_internal(s, pid, ucred, label, label_len, unit_id, true, ret);
 };
 
+ClientContext *client_context_pin(Server *s, ClientContext *c) {
+        assert(s);
+        assert(c);
+
+        /* Takes an additional reference to a context we already have, so that it is not flushed out of the cache
+         * until it is released again with client_context_release(). */
+
+        if (c->in_lru) {
+                /* The entry wasn't pinned so far, let's remove it from the LRU list then */
+                assert(c->n_ref == 0);
+                assert_se(prioq_remove(s->client_contexts_lru, c, &c->lru_index) >= 0);
+                c->in_lru = false;
+        }
+
+        c->n_ref++;
+        return c;
+}
+
 ClientContext *client_context_release(Server *s, ClientContext *c) {
         assert(s);
 
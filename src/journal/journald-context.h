@@ -52,6 +52,13 @@ struct ClientContext {
 
         usec_t log_rate_limit_interval;
         unsigned log_rate_limit_burst;
+
+        uint64_t units_generation;
+
+        /* The trusted fields formatted from the above, built on first use after each refresh */
+        char **fields;
+        struct iovec *fields_iovec;
+        size_t fields_n_iovec;
 };
 
 int client_context_get(
@@ -70,6 +77,7 @@ int client_context_acquire(
                 const char *unit_id,
                 ClientContext **ret);
 
+ClientContext* client_context_pin(Server *s, ClientContext *c);
 ClientContext* client_context_release(Server *s, ClientContext *c);
 
 void client_context_maybe_refresh(
@@ -83,6 +91,10 @@ void client_context_maybe_refresh(
 void client_context_acquire_default(Server *s);
 void client_context_flush_all(Server *s);
 
+int client_context_watch_units(Server *s);
+
+int client_context_get_fields(ClientContext *c, const struct iovec **ret, size_t *ret_n);
+
 static inline size_t client_context_extra_fields_n_iovec(const ClientContext *c) {
         return c ? c->extra_fields_n_iovec : 0;
 }
@@ -185,7 +185,15 @@ static unsigned burst_modulate(unsigned burst, uint64_t available) {
         return burst;
 }
 
-int journal_rate_limit_test(JournalRateLimit *r, const char *id, usec_t rl_interval, unsigned rl_burst, int priority, uint64_t available) {
+int journal_rate_limit_test(
+                JournalRateLimit *r,
+                const char *id,
+                usec_t rl_interval,
+                unsigned rl_burst,
+                int priority,
+                journal_rate_limit_available_t get_available,
+                void *userdata) {
+
         uint64_t h;
         JournalRateLimitGroup *g;
         JournalRateLimitPool *p;
@@ -217,14 +225,23 @@ int journal_rate_limit_test(JournalRateLimit *r, const char *id, usec_t rl_inter
                 g = journal_rate_limit_group_new(r, id, rl_interval, ts);
                 if (!g)
                         return -ENOMEM;
-        } else
+        } else {
                 g->interval = rl_interval;
 
+                /* Move the group to the front of the LRU list, so that vacuuming drops the groups used least
+                 * recently, not the ones created first */
+                if (r->lru != g) {
+                        if (r->lru_tail == g)
+                                r->lru_tail = g->lru_prev;
+
+                        LIST_REMOVE(lru, r->lru, g);
+                        LIST_PREPEND(lru, r->lru, g);
+                }
+        }
+
         if (rl_interval == 0 || rl_burst == 0)
                 return 1;
 
-        burst = burst_modulate(rl_burst, available);
-
         p = &g->pools[priority_map[priority]];
 
         if (p->begin <= 0) {
@@ -245,6 +262,15 @@ int journal_rate_limit_test(JournalRateLimit *r, const char *id, usec_t rl_inter
                 return 1 + s;
         }
 
+        /* The burst is only ever modulated upwards, hence we only need to determine the available disk space, which
+         * might be expensive, once the unmodulated burst is used up. */
+        if (p->num < rl_burst) {
+                p->num++;
+                return 1;
+        }
+
+        burst = get_available ? burst_modulate(rl_burst, get_available(userdata)) : rl_burst;
+
         if (p->num < burst) {
                 p->num++;
                 return 1;
@@ -5,6 +5,8 @@
 
 typedef struct JournalRateLimit JournalRateLimit;
 
+typedef uint64_t (*journal_rate_limit_available_t)(void *userdata);
+
 JournalRateLimit *journal_rate_limit_new(void);
 void journal_rate_limit_free(JournalRateLimit *r);
-int journal_rate_limit_test(JournalRateLimit *r, const char *id, usec_t rl_interval, unsigned rl_burst, int priority, uint64_t available);
+int journal_rate_limit_test(JournalRateLimit *r, const char *id, usec_t rl_interval, unsigned rl_burst, int priority, journal_rate_limit_available_t get_available, void *userdata);
@@ -67,15 +67,15 @@
 
 #define NOTIFY_SNDBUF_SIZE (8*1024*1024)
 
-/* The period to insert between posting changes for coalescing */
-#define POST_CHANGE_TIMER_INTERVAL_USEC (250*USEC_PER_MSEC)
-
 /* Pick a good default that is likely to fit into AF_UNIX and AF_INET SOCK_DGRAM datagrams, and even leaves some room
  * for a bit of additional metadata. */
 #define DEFAULT_LINE_MAX (48*1024)
 
 #define DEFERRED_CLOSES_MAX (4096)
 
+/* How many datagrams to read from a socket at max before going back to the event loop */
+#define DATAGRAMS_PER_WAKEUP_MAX 64
+
 static int determine_path_usage(Server *s, const char *path, uint64_t *ret_used, uint64_t *ret_free) {
         _cleanup_closedir_ DIR *d = NULL;
         struct dirent *de;
@@ -789,23 +789,14 @@ static bool shall_try_append_again(JournalFile *f, int r) {
         }
 }
 
-static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, size_t n, int priority) {
-        bool vacuumed = false, rotate = false;
-        struct dual_timestamp ts;
+static JournalFile* find_journal_for_write(Server *s, uid_t uid, usec_t realtime, bool *vacuumed) {
+        bool rotate = false;
         JournalFile *f;
-        int r;
 
         assert(s);
-        assert(iovec);
-        assert(n > 0);
-
-        /* Get the closest, linearized time we have for this log event from the event loop. (Note that we do not use
-         * the source time, and not even the time the event was originally seen, but instead simply the time we started
-         * processing it, as we want strictly linear ordering in what we write out.) */
-        assert_se(sd_event_now(s->event, CLOCK_REALTIME, &ts.realtime) >= 0);
-        assert_se(sd_event_now(s->event, CLOCK_MONOTONIC, &ts.monotonic) >= 0);
+        assert(vacuumed);
 
-        if (ts.realtime < s->last_realtime_clock) {
+        if (realtime < s->last_realtime_clock) {
                 /* When the time jumps backwards, let's immediately rotate. Of course, this should not happen during
                  * regular operation. However, when it does happen, then we should make sure that we start fresh files
                  * to ensure that the entries in the journal files are strictly ordered by time, in order to ensure
@@ -817,7 +808,7 @@ static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, size_t n
 
                 f = find_journal(s, uid);
                 if (!f)
-                        return;
+                        return NULL;
 
                 if (journal_file_rotate_suggested(f, s->max_file_usec)) {
                         log_debug("%s: Journal header limits reached or header out-of-date, rotating.", f->path);
@@ -828,14 +819,107 @@ static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, size_t n
         if (rotate) {
                 server_rotate(s);
                 server_vacuum(s, false);
-                vacuumed = true;
+                *vacuumed = true;
 
                 f = find_journal(s, uid);
                 if (!f)
+                        return NULL;
+        }
+
+        s->last_realtime_clock = realtime;
+
+        return f;
+}
+
+static void server_flush_batch(Server *s) {
+        JournalBatch *b = &s->batch;
+        bool vacuumed = false, written = false;
+        JournalFile *f;
+        int r;
+
+        assert(s);
+
+        if (b->n_entries == 0)
+                return;
+
+        /* All entries in the batch were collected in the same event loop iteration, hence carry the same
+         * timestamp */
+        f = find_journal_for_write(s, s->batch_uid, b->entries[0].ts.realtime, &vacuumed);
+
+        while (f && b->n_written < b->n_entries) {
+                const JournalBatchEntry *e;
+                size_t n_written = b->n_written;
+
+                r = journal_file_append_batch(f, b, &s->seqnum);
+                if (b->n_written > n_written) {
+                        written = true;
+
+                        /* Rotate and retry once more for the entry that failed, even if we did so for an
+                         * earlier one already */
+                        vacuumed = false;
+                }
+                if (r >= 0)
+                        break;
+
+                e = b->entries + b->n_written;
+
+                if (vacuumed || !shall_try_append_again(f, r)) {
+                        log_error_errno(r, "Failed to write entry (%zu items, %zu bytes)%s, ignoring: %m",
+                                        e->n_items, e->size, vacuumed ? " despite vacuuming" : "");
+                        b->n_written++;
+                        continue;
+                }
+
+                server_rotate(s);
+                server_vacuum(s, false);
+                vacuumed = true;
+
+                f = find_journal(s, s->batch_uid);
+                if (f)
+                        log_debug("Retrying write.");
+        }
+
+        if (written)
+                server_schedule_sync(s, s->batch_priority);
+
+        journal_batch_clear(b);
+}
+
+static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, size_t n, int priority) {
+        bool vacuumed = false;
+        struct dual_timestamp ts;
+        JournalFile *f;
+        int r;
+
+        assert(s);
+        assert(iovec);
+        assert(n > 0);
+
+        /* Get the closest, linearized time we have for this log event from the event loop. (Note that we do not use
+         * the source time, and not even the time the event was originally seen, but instead simply the time we started
+         * processing it, as we want strictly linear ordering in what we write out.) */
+        assert_se(sd_event_now(s->event, CLOCK_REALTIME, &ts.realtime) >= 0);
+        assert_se(sd_event_now(s->event, CLOCK_MONOTONIC, &ts.monotonic) >= 0);
+
+        if (s->batching) {
+                /* We are processing a burst of datagrams, collect the entry, and write it out together with
+                 * the others once we are done. Entries for different users go to different files. */
+                if (s->batch.n_entries > 0 && s->batch_uid != uid)
+                        server_flush_batch(s);
+
+                r = journal_batch_add(&s->batch, &ts, iovec, n);
+                if (r >= 0) {
+                        s->batch_uid = uid;
+                        s->batch_priority = s->batch.n_entries == 1 ? priority : MIN(s->batch_priority, priority);
                         return;
+                }
+
+                log_debug_errno(r, "Failed to queue entry, writing it right away: %m");
         }
 
-        s->last_realtime_clock = ts.realtime;
+        f = find_journal_for_write(s, uid, ts.realtime, &vacuumed);
+        if (!f)
+                return;
 
         r = journal_file_append_entry(f, &ts, NULL, iovec, n, &s->seqnum, NULL, NULL);
         if (r >= 0) {
@@ -897,14 +981,14 @@ static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, size_t n
 static void dispatch_message_real(
                 Server *s,
                 struct iovec *iovec, size_t n, size_t m,
-                const ClientContext *c,
+                ClientContext *c,
                 const struct timeval *tv,
                 int priority,
                 pid_t object_pid) {
 
         char source_time[sizeof("_SOURCE_REALTIME_TIMESTAMP=") + DECIMAL_STR_MAX(usec_t)];
         uid_t journal_uid;
-        ClientContext *o;
+        ClientContext *o = NULL;
 
         assert(s);
         assert(iovec);
@@ -914,30 +998,53 @@ static void dispatch_message_real(
                (pid_is_valid(object_pid) ? N_IOVEC_OBJECT_FIELDS : 0) +
                client_context_extra_fields_n_iovec(c) <= m);
 
+        /* Look up the object's context first: doing so might refresh it, and if it is the same as the client's that
+         * would invalidate the cached fields we add below. A cache miss might also flush out unpinned entries, hence
+         * pin the client's context until we are done with it. */
+        if (c)
+                client_context_pin(s, c);
+
+        if (pid_is_valid(object_pid) && client_context_get(s, object_pid, NULL, NULL, 0, NULL, &o) < 0)
+                o = NULL;
+
         if (c) {
-                IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->pid, pid_t, pid_is_valid, PID_FMT, "_PID");
-                IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->uid, uid_t, uid_is_valid, UID_FMT, "_UID");
-                IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->gid, gid_t, gid_is_valid, GID_FMT, "_GID");
+                const struct iovec *fields;
+                size_t n_fields;
+                int r;
 
-                IOVEC_ADD_STRING_FIELD(iovec, n, c->comm, "_COMM");
-                IOVEC_ADD_STRING_FIELD(iovec, n, c->exe, "_EXE");
-                IOVEC_ADD_STRING_FIELD(iovec, n, c->cmdline, "_CMDLINE");
-                IOVEC_ADD_STRING_FIELD(iovec, n, c->capeff, "_CAP_EFFECTIVE");
+                r = client_context_get_fields(c, &fields, &n_fields);
+                if (r >= 0) {
+                        memcpy(iovec + n, fields, n_fields * sizeof(struct iovec));
+                        n += n_fields;
+                } else {
+                        /* Let's not lose the message if we can't cache the fields, and format them on the stack
+                         * instead. */
+                        log_debug_errno(r, "Failed to cache metadata of client " PID_FMT ", formatting it for this message only: %m", c->pid);
+
+                        IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->pid, pid_t, pid_is_valid, PID_FMT, "_PID");
+                        IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->uid, uid_t, uid_is_valid, UID_FMT, "_UID");
+                        IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->gid, gid_t, gid_is_valid, GID_FMT, "_GID");
 
-                IOVEC_ADD_SIZED_FIELD(iovec, n, c->label, c->label_size, "_SELINUX_CONTEXT");
+                        IOVEC_ADD_STRING_FIELD(iovec, n, c->comm, "_COMM");
+                        IOVEC_ADD_STRING_FIELD(iovec, n, c->exe, "_EXE");
+                        IOVEC_ADD_STRING_FIELD(iovec, n, c->cmdline, "_CMDLINE");
+                        IOVEC_ADD_STRING_FIELD(iovec, n, c->capeff, "_CAP_EFFECTIVE");
 
-                IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->auditid, uint32_t, audit_session_is_valid, "%" PRIu32, "_AUDIT_SESSION");
-                IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->loginuid, uid_t, uid_is_valid, UID_FMT, "_AUDIT_LOGINUID");
+                        IOVEC_ADD_SIZED_FIELD(iovec, n, c->label, c->label_size, "_SELINUX_CONTEXT");
 
-                IOVEC_ADD_STRING_FIELD(iovec, n, c->cgroup, "_SYSTEMD_CGROUP");
-                IOVEC_ADD_STRING_FIELD(iovec, n, c->session, "_SYSTEMD_SESSION");
-                IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->owner_uid, uid_t, uid_is_valid, UID_FMT, "_SYSTEMD_OWNER_UID");
-                IOVEC_ADD_STRING_FIELD(iovec, n, c->unit, "_SYSTEMD_UNIT");
-                IOVEC_ADD_STRING_FIELD(iovec, n, c->user_unit, "_SYSTEMD_USER_UNIT");
-                IOVEC_ADD_STRING_FIELD(iovec, n, c->slice, "_SYSTEMD_SLICE");
-                IOVEC_ADD_STRING_FIELD(iovec, n, c->user_slice, "_SYSTEMD_USER_SLICE");
+                        IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->auditid, uint32_t, audit_session_is_valid, "%" PRIu32, "_AUDIT_SESSION");
+                        IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->loginuid, uid_t, uid_is_valid, UID_FMT, "_AUDIT_LOGINUID");
 
-                IOVEC_ADD_ID128_FIELD(iovec, n, c->invocation_id, "_SYSTEMD_INVOCATION_ID");
+                        IOVEC_ADD_STRING_FIELD(iovec, n, c->cgroup, "_SYSTEMD_CGROUP");
+                        IOVEC_ADD_STRING_FIELD(iovec, n, c->session, "_SYSTEMD_SESSION");
+                        IOVEC_ADD_NUMERIC_FIELD(iovec, n, c->owner_uid, uid_t, uid_is_valid, UID_FMT, "_SYSTEMD_OWNER_UID");
+                        IOVEC_ADD_STRING_FIELD(iovec, n, c->unit, "_SYSTEMD_UNIT");
+                        IOVEC_ADD_STRING_FIELD(iovec, n, c->user_unit, "_SYSTEMD_USER_UNIT");
+                        IOVEC_ADD_STRING_FIELD(iovec, n, c->slice, "_SYSTEMD_SLICE");
+                        IOVEC_ADD_STRING_FIELD(iovec, n, c->user_slice, "_SYSTEMD_USER_SLICE");
+
+                        IOVEC_ADD_ID128_FIELD(iovec, n, c->invocation_id, "_SYSTEMD_INVOCATION_ID");
+                }
 
                 if (c->extra_fields_n_iovec > 0) {
                         memcpy(iovec + n, c->extra_fields_iovec, c->extra_fields_n_iovec * sizeof(struct iovec));
@@ -947,7 +1054,7 @@ static void dispatch_message_real(
 
         assert(n <= m);
 
-        if (pid_is_valid(object_pid) && client_context_get(s, object_pid, NULL, NULL, 0, NULL, &o) >= 0) {
+        if (o) {
 
                 IOVEC_ADD_NUMERIC_FIELD(iovec, n, o->pid, pid_t, pid_is_valid, PID_FMT, "OBJECT_PID");
                 IOVEC_ADD_NUMERIC_FIELD(iovec, n, o->uid, uid_t, uid_is_valid, UID_FMT, "OBJECT_UID");
@@ -1009,6 +1116,8 @@ static void dispatch_message_real(
                 journal_uid = 0;
 
         write_to_journal(s, journal_uid, iovec, n, priority);
+
+        client_context_release(s, c);
 }
 
 void server_driver_message(Server *s, pid_t object_pid, const char *message_id, const char *format, ...) {
@@ -1060,6 +1169,16 @@ void server_driver_message(Server *s, pid_t object_pid, const char *message_id,
         }
 }
 
+static uint64_t rate_limit_available(void *userdata) {
+        Server *s = userdata;
+        uint64_t available = 0;
+
+        assert(s);
+
+        (void) determine_space(s, &available, NULL);
+        return available;
+}
+
 void server_dispatch_message(
                 Server *s,
                 struct iovec *iovec, size_t n, size_t m,
@@ -1068,7 +1187,6 @@ void server_dispatch_message(
                 int priority,
                 pid_t object_pid) {
 
-        uint64_t available = 0;
         int rl;
 
         assert(s);
@@ -1086,9 +1204,7 @@ void server_dispatch_message(
                 return;
 
         if (c && c->unit) {
-                (void) determine_space(s, &available, NULL);
-
-                rl = journal_rate_limit_test(s->rate_limit, c->unit, c->log_rate_limit_interval, c->log_rate_limit_burst, priority & LOG_PRIMASK, available);
+                rl = journal_rate_limit_test(s->rate_limit, c->unit, c->log_rate_limit_interval, c->log_rate_limit_burst, priority & LOG_PRIMASK, rate_limit_available, s);
                 if (rl == 0)
                         return;
 
@@ -1205,8 +1321,7 @@ finish:
         return r;
 }
 
-int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
-        Server *s = userdata;
+static int server_receive_datagram(Server *s, int fd) {
         struct ucred *ucred = NULL;
         struct timeval *tv = NULL;
         struct cmsghdr *cmsg;
@@ -1245,12 +1360,6 @@ int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void
         };
 
         assert(s);
-        assert(fd == s->native_fd || fd == s->syslog_fd || fd == s->audit_fd);
-
-        if (revents != EPOLLIN) {
-                log_error("Got invalid event from epoll for datagram fd: %"PRIx32, revents);
-                return -EIO;
-        }
 
         /* Try to get the right size, if we can. (Not all sockets support SIOCINQ, hence we just try, but don't rely on
          * it.) */
@@ -1270,7 +1379,7 @@ int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void
         n = recvmsg(fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
         if (n < 0) {
                 if (IN_SET(errno, EINTR, EAGAIN))
-                        return 0;
+                        return 0; /* Nothing queued anymore */
 
                 return log_error_errno(errno, "recvmsg() failed: %m");
         }
@@ -1323,7 +1432,38 @@ int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void
         }
 
         close_many(fds, n_fds);
-        return 0;
+        return 1;
+}
+
+int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
+        Server *s = userdata;
+        unsigned i;
+        int r = 0;
+
+        assert(s);
+        assert(fd == s->native_fd || fd == s->syslog_fd || fd == s->audit_fd);
+
+        if (revents != EPOLLIN) {
+                log_error("Got invalid event from epoll for datagram fd: %"PRIx32, revents);
+                return -EIO;
+        }
+
+        /* When busy, clients queue up lots of datagrams at once. Process a bunch of them for each wakeup instead
+         * of going through the event loop for every single one, but not too many, so that the other event
+         * sources still get their turn. The entries are collected and appended to the journal files in one
+         * go at the end. */
+        s->batching = true;
+
+        for (i = 0; i < DATAGRAMS_PER_WAKEUP_MAX; i++) {
+                r = server_receive_datagram(s, fd);
+                if (r <= 0)
+                        break;
+        }
+
+        s->batching = false;
+        server_flush_batch(s);
+
+        return r < 0 ? r : 0;
 }
 
 static int dispatch_sigusr1(sd_event_source *es, const struct signalfd_siginfo *si, void *userdata) {
@@ -1569,51 +1709,61 @@ static int server_dispatch_sync(sd_event_source *es, usec_t t, void *userdata) {
 }
 
 int server_schedule_sync(Server *s, int priority) {
+        usec_t when;
         int r;
 
         assert(s);
 
-        if (priority <= LOG_CRIT) {
-                /* Immediately sync to disk when this is of priority CRIT, ALERT, EMERG */
-                server_sync(s);
-                return 0;
-        }
-
-        if (s->sync_scheduled)
-                return 0;
-
-        if (s->sync_interval_usec > 0) {
-                usec_t when;
+        if (priority <= LOG_CRIT)
+                /* Sync to disk right away when this is of priority CRIT, ALERT, EMERG. We don't do that here but from
+                 * the next event loop iteration however (the sync event source is of high priority, and 0 means the
+                 * timer elapsed already), so that a burst of such messages results in a single sync only. */
+                when = 0;
+        else {
+                if (s->sync_scheduled || s->sync_interval_usec == 0)
+                        return 0;
 
                 r = sd_event_now(s->event, CLOCK_MONOTONIC, &when);
                 if (r < 0)
                         return r;
 
                 when += s->sync_interval_usec;
+        }
 
-                if (!s->sync_event_source) {
-                        r = sd_event_add_time(
-                                        s->event,
-                                        &s->sync_event_source,
-                                        CLOCK_MONOTONIC,
-                                        when, 0,
-                                        server_dispatch_sync, s);
-                        if (r < 0)
-                                return r;
+        if (s->sync_scheduled) {
+                usec_t t;
 
-                        r = sd_event_source_set_priority(s->sync_event_source, SD_EVENT_PRIORITY_IMPORTANT);
-                } else {
-                        r = sd_event_source_set_time(s->sync_event_source, when);
-                        if (r < 0)
-                                return r;
+                /* Only ever move an already scheduled sync closer */
+                r = sd_event_source_get_time(s->sync_event_source, &t);
+                if (r < 0)
+                        return r;
 
-                        r = sd_event_source_set_enabled(s->sync_event_source, SD_EVENT_ONESHOT);
-                }
+                if (t <= when)
+                        return 0;
+        }
+
+        if (!s->sync_event_source) {
+                r = sd_event_add_time(
+                                s->event,
+                                &s->sync_event_source,
+                                CLOCK_MONOTONIC,
+                                when, 0,
+                                server_dispatch_sync, s);
                 if (r < 0)
                         return r;
 
-                s->sync_scheduled = true;
+                r = sd_event_source_set_priority(s->sync_event_source, SD_EVENT_PRIORITY_IMPORTANT);
+        } else {
+                r = sd_event_source_set_time(s->sync_event_source, when);
+                if (r < 0)
+                        return r;
+
+                r = sd_event_source_set_enabled(s->sync_event_source, SD_EVENT_ONESHOT);
         }
+        if (r < 0)
+                return r;
+
+        s->sync_scheduled = true;
 
         return 0;
 }
@@ -1984,6 +2134,8 @@ int server_init(Server *s) {
         if (r < 0)
                 return r;
 
+        (void) client_context_watch_units(s);
+
         s->rate_limit = journal_rate_limit_new();
         if (!s->rate_limit)
                 return -ENOMEM;
@@ -2045,6 +2197,8 @@ void server_done(Server *s) {
 
         ordered_hashmap_free_with_destructor(s->user_journals, journal_file_close);
 
+        journal_batch_done(&s->batch);
+
         sd_event_source_unref(s->syslog_event_source);
         sd_event_source_unref(s->native_event_source);
         sd_event_source_unref(s->stdout_event_source);
@@ -2059,6 +2213,7 @@ void server_done(Server *s) {
         sd_event_source_unref(s->hostname_event_source);
         sd_event_source_unref(s->notify_event_source);
         sd_event_source_unref(s->watchdog_event_source);
+        sd_event_source_unref(s->units_event_source);
         sd_event_unref(s->event);
 
         safe_close(s->syslog_fd);
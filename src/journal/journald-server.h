@@ -82,6 +82,7 @@ struct Server {
         sd_event_source *hostname_event_source;
         sd_event_source *notify_event_source;
         sd_event_source *watchdog_event_source;
+        sd_event_source *units_event_source;
 
         JournalFile *runtime_journal;
         JournalFile *system_journal;
@@ -155,6 +156,12 @@ struct Server {
 
         usec_t last_realtime_clock;
 
+        /* Entries collected while processing a burst of datagrams, written out together */
+        JournalBatch batch;
+        uid_t batch_uid;
+        int batch_priority;
+        bool batching;
+
         size_t line_max;
 
         /* Caching of client metadata */
@@ -163,6 +170,13 @@ struct Server {
 
         ClientContext *my_context; /* the context of journald itself */
         ClientContext *pid1_context; /* the context of PID 1 */
+
+        /* Bumped whenever something in /run/systemd/units/ changes, 0 if we can't watch it */
+        uint64_t units_generation;
+
+        unsigned n_client_context_hits;
+        unsigned n_client_context_misses;
+        unsigned n_client_context_refreshes;
 };
 
 #define SERVER_MACHINE_ID(s) ((s)->machine_id_field + STRLEN("_MACHINE_ID="))
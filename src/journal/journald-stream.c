@@ -35,6 +35,9 @@
 
 #define STDOUT_STREAMS_MAX 4096
 
+/* How many times to read from a stream per event loop wakeup at most */
+#define STDOUT_STREAM_READS_PER_WAKEUP_MAX 16
+
 typedef enum StdoutStreamState {
         STDOUT_STREAM_IDENTIFIER,
         STDOUT_STREAM_UNIT_ID,
@@ -78,6 +81,7 @@ struct StdoutStream {
         char *buffer;
         size_t length;
         size_t allocated;
+        size_t scanned; /* how many bytes at the beginning of the buffer are known to contain no line break */
 
         sd_event_source *event_source;
 
@@ -422,7 +426,7 @@ static int stdout_stream_line(StdoutStream *s, char *p, LineBreak line_break) {
 
 static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
         char *p;
-        size_t remaining;
+        size_t remaining, scanned;
         int r;
 
         assert(s);
@@ -430,6 +434,11 @@ static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
         p = s->buffer;
         remaining = s->length;
 
+        /* The bytes left over from the previous invocation have already been searched for line breaks, don't do
+         * that again. Otherwise a long line arriving in many small reads would be rescanned from its beginning on
+         * every single read. */
+        scanned = MIN(s->scanned, remaining);
+
         /* XXX: This function does nothing if (s->length == 0) */
 
         for (;;) {
@@ -437,8 +446,9 @@ static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
                 size_t skip;
                 char *end1, *end2;
 
-                end1 = memchr(p, '\n', remaining);
-                end2 = memchr(p, 0, end1 ? (size_t) (end1 - p) : remaining);
+                end1 = memchr(p + scanned, '\n', remaining - scanned);
+                end2 = memchr(p + scanned, 0, end1 ? (size_t) (end1 - p) - scanned : remaining - scanned);
+                scanned = 0;
 
                 if (end2) {
                         /* We found a NUL terminator */
@@ -454,8 +464,11 @@ static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
                         *(p + s->server->line_max) = 0;
                         skip = remaining;
                         line_break = LINE_BREAK_LINE_MAX;
-                } else
+                } else {
+                        /* No line break in what is left, remember that for the next invocation */
+                        scanned = remaining;
                         break;
+                }
 
                 r = stdout_stream_line(s, p, line_break);
                 if (r < 0)
@@ -473,6 +486,7 @@ static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
 
                 p += remaining;
                 remaining = 0;
+                scanned = 0;
         }
 
         if (p > s->buffer) {
@@ -480,13 +494,14 @@ static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
                 s->length = remaining;
         }
 
+        s->scanned = scanned;
+
         return 0;
 }
 
 static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents, void *userdata) {
         StdoutStream *s = userdata;
-        size_t limit;
-        ssize_t l;
+        unsigned n;
         int r;
 
         assert(s);
@@ -496,36 +511,50 @@ static int stdout_stream_process(sd_event_source *es, int fd, uint32_t revents,
                 goto terminate;
         }
 
-        /* If the buffer is full already (discounting the extra NUL we need), add room for another 1K */
-        if (s->length + 1 >= s->allocated) {
-                if (!GREEDY_REALLOC(s->buffer, s->allocated, s->length + 1 + 1024)) {
-                        log_oom();
-                        goto terminate;
+        /* Keep reading as long as the client fills up the whole buffer space we offer, so that a client writing a
+         * lot of output doesn't cost us a full event loop iteration per read. But don't do that indefinitely, so
+         * that other streams and sockets are not starved by a single chatty client. */
+        for (n = 0; n < STDOUT_STREAM_READS_PER_WAKEUP_MAX; n++) {
+                size_t limit, want;
+                ssize_t l;
+
+                /* If the buffer is full already (discounting the extra NUL we need), add room for another 1K */
+                if (s->length + 1 >= s->allocated) {
+                        if (!GREEDY_REALLOC(s->buffer, s->allocated, s->length + 1 + 1024)) {
+                                log_oom();
+                                goto terminate;
+                        }
                 }
-        }
 
-        /* Try to make use of the allocated buffer in full, but never read more than the configured line size. Also,
-         * always leave room for a terminating NUL we might need to add. */
-        limit = MIN(s->allocated - 1, s->server->line_max);
+                /* Try to make use of the allocated buffer in full, but never read more than the configured line
+                 * size. Also, always leave room for a terminating NUL we might need to add. */
+                limit = MIN(s->allocated - 1, s->server->line_max);
+                want = limit - s->length;
 
-        l = read(s->fd, s->buffer + s->length, limit - s->length);
-        if (l < 0) {
-                if (errno == EAGAIN)
-                        return 0;
+                l = read(s->fd, s->buffer + s->length, want);
+                if (l < 0) {
+                        if (errno == EAGAIN)
+                                return 0;
 
-                log_warning_errno(errno, "Failed to read from stream: %m");
-                goto terminate;
-        }
+                        log_warning_errno(errno, "Failed to read from stream: %m");
+                        goto terminate;
+                }
 
-        if (l == 0) {
-                stdout_stream_scan(s, true);
-                goto terminate;
-        }
+                if (l == 0) {
+                        stdout_stream_scan(s, true);
+                        goto terminate;
+                }
 
-        s->length += l;
-        r = stdout_stream_scan(s, false);
-        if (r < 0)
-                goto terminate;
+                s->length += l;
+                r = stdout_stream_scan(s, false);
+                if (r < 0)
+                        goto terminate;
+
+                /* A short read means the pipe is drained, don't bother with another read() that would only
+                 * return EAGAIN. */
+                if ((size_t) l < want)
+                        break;
+        }
 
         return 1;
 
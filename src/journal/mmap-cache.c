@@ -11,6 +11,7 @@
 #include "log.h"
 #include "macro.h"
 #include "mmap-cache.h"
+#include "parse-util.h"
 #include "sigbus.h"
 #include "util.h"
 
@@ -42,6 +43,11 @@ struct Context {
         unsigned id;
         Window *window;
 
+        /* The last window this context mapped, to detect sequential access */
+        MMapFileDescriptor *last_fd;
+        uint64_t last_offset, last_end;
+        uint64_t window_size;
+
         LIST_FIELDS(Context, by_window);
 };
 
@@ -55,8 +61,9 @@ struct MMapFileDescriptor {
 struct MMapCache {
         unsigned n_ref;
         unsigned n_windows;
+        uint64_t n_window_bytes, n_unused_bytes;
 
-        unsigned n_hit, n_missed;
+        unsigned n_context_cache_hit, n_window_list_hit, n_missed, n_unmapped;
 
         Hashmap *fds;
         Context *contexts[MMAP_CACHE_MAX_CONTEXTS];
@@ -70,10 +77,16 @@ struct MMapCache {
 #if ENABLE_DEBUG_MMAP_CACHE
 /* Tiny windows increase mmap activity and the chance of exposing unsafe use. */
 # define WINDOW_SIZE (page_size())
+# define WINDOW_SIZE_MAX WINDOW_SIZE
 #else
 # define WINDOW_SIZE (8ULL*1024ULL*1024ULL)
+/* Sequential access grows the windows up to this, unless address space is scarce */
+# define WINDOW_SIZE_MAX (sizeof(void*) > 4 ? 64ULL*1024ULL*1024ULL : WINDOW_SIZE)
 #endif
 
+/* How much memory to keep mapped in windows nobody uses anymore at max, across all files */
+#define UNUSED_BYTES_MAX (WINDOWS_MIN * WINDOW_SIZE)
+
 MMapCache* mmap_cache_new(void) {
         MMapCache *m;
 
@@ -90,8 +103,11 @@ static void window_unlink(Window *w) {
 
         assert(w);
 
-        if (w->ptr)
+        if (w->ptr) {
                 munmap(w->ptr, w->size);
+                w->cache->n_window_bytes -= w->size;
+                w->cache->n_unmapped++;
+        }
 
         if (w->fd)
                 LIST_REMOVE(by_fd, w->fd->windows, w);
@@ -101,6 +117,7 @@ static void window_unlink(Window *w) {
                         w->cache->last_unused = w->unused_prev;
 
                 LIST_REMOVE(unused, w->cache->unused, w);
+                w->cache->n_unused_bytes -= w->size;
         }
 
         LIST_FOREACH(by_window, c, w->contexts) {
@@ -181,6 +198,8 @@ static Window *window_add(MMapCache *m, MMapFileDescriptor *f, int prot, bool ke
         w->size = size;
         w->ptr = ptr;
 
+        m->n_window_bytes += size;
+
         LIST_PREPEND(by_fd, f->windows, w);
 
         return w;
@@ -209,6 +228,11 @@ static void context_detach_window(Context *c) {
                         c->cache->last_unused = w;
 
                 w->in_unused = true;
+                c->cache->n_unused_bytes += w->size;
+
+                /* Drop the least recently used windows if we keep too much around */
+                while (c->cache->n_unused_bytes > UNUSED_BYTES_MAX && c->cache->last_unused != w)
+                        window_free(c->cache->last_unused);
 #endif
         }
 }
@@ -229,6 +253,7 @@ static void context_attach_window(Context *c, Window *w) {
                         c->cache->last_unused = w->unused_prev;
 
                 w->in_unused = false;
+                c->cache->n_unused_bytes -= w->size;
         }
 
         c->window = w;
@@ -428,7 +453,8 @@ static int add_mmap(
                 void **ret,
                 size_t *ret_size) {
 
-        uint64_t woffset, wsize;
+        uint64_t woffset, wsize, window_size;
+        bool sequential;
         Context *c;
         Window *w;
         void *d;
@@ -440,21 +466,32 @@ static int add_mmap(
         assert(size > 0);
         assert(ret);
 
+        c = context_add(m, context);
+        if (!c)
+                return -ENOMEM;
+
+        /* If this context is asked for memory just beyond the window it mapped last, it's most likely
+         * scanning through the file, hence map the following part of the file, and map more of it each
+         * time. Otherwise map the area around the requested memory. */
+        sequential = c->last_fd == f && offset >= c->last_offset && offset < c->last_end + c->window_size;
+        c->window_size = sequential ? MIN(c->window_size * 2, WINDOW_SIZE_MAX) : WINDOW_SIZE;
+        window_size = c->window_size;
+
         woffset = offset & ~((uint64_t) page_size() - 1ULL);
         wsize = size + (offset - woffset);
         wsize = PAGE_ALIGN(wsize);
 
-        if (wsize < WINDOW_SIZE) {
+        if (wsize < window_size) {
                 uint64_t delta;
 
-                delta = PAGE_ALIGN((WINDOW_SIZE - wsize) / 2);
+                delta = sequential ? 0 : PAGE_ALIGN((window_size - wsize) / 2);
 
                 if (delta > offset)
                         woffset = 0;
                 else
                         woffset -= delta;
 
-                wsize = WINDOW_SIZE;
+                wsize = window_size;
         }
 
         if (st) {
@@ -473,16 +510,16 @@ static int add_mmap(
         if (r < 0)
                 return r;
 
-        c = context_add(m, context);
-        if (!c)
-                goto outofmem;
-
         w = window_add(m, f, prot, keep_always, woffset, wsize, d);
         if (!w)
                 goto outofmem;
 
         context_attach_window(c, w);
 
+        c->last_fd = f;
+        c->last_offset = woffset;
+        c->last_end = woffset + wsize;
+
         *ret = (uint8_t*) w->ptr + (offset - w->offset);
         if (ret_size)
                 *ret_size = w->size - (offset - w->offset);
@@ -518,14 +555,14 @@ int mmap_cache_get(
         /* Check whether the current context is the right one already */
         r = try_context(m, f, prot, context, keep_always, offset, size, ret, ret_size);
         if (r != 0) {
-                m->n_hit++;
+                m->n_context_cache_hit++;
                 return r;
         }
 
         /* Search for a matching mmap */
         r = find_mmap(m, f, prot, context, keep_always, offset, size, ret, ret_size);
         if (r != 0) {
-                m->n_hit++;
+                m->n_window_list_hit++;
                 return r;
         }
 
@@ -538,7 +575,7 @@ int mmap_cache_get(
 unsigned mmap_cache_get_hit(MMapCache *m) {
         assert(m);
 
-        return m->n_hit;
+        return m->n_context_cache_hit + m->n_window_list_hit;
 }
 
 unsigned mmap_cache_get_missed(MMapCache *m) {
@@ -547,6 +584,19 @@ unsigned mmap_cache_get_missed(MMapCache *m) {
         return m->n_missed;
 }
 
+void mmap_cache_stats_log_debug(MMapCache *m) {
+        char mapped[FORMAT_BYTES_MAX], unused[FORMAT_BYTES_MAX];
+
+        assert(m);
+
+        log_debug("mmap cache statistics: %u context cache hit, %u window list hit, %u miss, %u unmap, "
+                  "%u windows, %s mapped, %s of it unused",
+                  m->n_context_cache_hit, m->n_window_list_hit, m->n_missed, m->n_unmapped,
+                  m->n_windows,
+                  format_bytes(mapped, sizeof(mapped), m->n_window_bytes),
+                  format_bytes(unused, sizeof(unused), m->n_unused_bytes));
+}
+
 static void mmap_cache_process_sigbus(MMapCache *m) {
         bool found = false;
         MMapFileDescriptor *f;
@@ -101,12 +101,30 @@ static int journal_put_error(sd_journal *j, int r, const char *path) {
         return 0;
 }
 
+static void files_prioq_invalidate(sd_journal *j) {
+        Iterator i;
+        JournalFile *f;
+
+        assert(j);
+
+        /* Drop the merge state, so that the next iteration step rebuilds it from scratch. */
+
+        if (j->files_prioq)
+                ORDERED_HASHMAP_FOREACH(f, j->files, i)
+                        f->location_prioq_idx = PRIOQ_IDX_NULL;
+
+        j->files_prioq = prioq_free(j->files_prioq);
+        j->files_growing = set_free(j->files_growing);
+}
+
 static void detach_location(sd_journal *j) {
         Iterator i;
         JournalFile *f;
 
         assert(j);
 
+        files_prioq_invalidate(j);
+
         j->current_file = NULL;
         j->current_field = 0;
 
@@ -673,6 +691,25 @@ static int find_location_for_match(
         }
 }
 
+static bool file_may_contain_location(JournalFile *f, const Location *l, direction_t direction) {
+        assert(f);
+        assert(l);
+
+        /* When seeking to a wallclock timestamp, the header tells us the time range covered by the file, hence
+         * files which end before (or start after) it can be skipped without bisecting their entry arrays. */
+
+        if (l->type != LOCATION_SEEK || !l->realtime_set || l->seqnum_set || l->monotonic_set)
+                return true;
+
+        if (le64toh(f->header->n_entries) <= 0)
+                return true;
+
+        if (direction == DIRECTION_DOWN)
+                return le64toh(f->header->tail_entry_realtime) >= l->realtime;
+        else
+                return le64toh(f->header->head_entry_realtime) <= l->realtime;
+}
+
 static int find_location_with_matches(
                 sd_journal *j,
                 JournalFile *f,
@@ -687,6 +724,9 @@ static int find_location_with_matches(
         assert(ret);
         assert(offset);
 
+        if (!file_may_contain_location(f, &j->current_location, direction))
+                return 0;
+
         if (!j->level0) {
                 /* No matches is simple */
 
@@ -802,48 +842,153 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
         }
 }
 
-static int real_journal_next(sd_journal *j, direction_t direction) {
-        JournalFile *new_file = NULL;
+static int compare_file_locations(const void *a, const void *b) {
+        JournalFile *x = (JournalFile*) a, *y = (JournalFile*) b;
+        int r;
+
+        r = journal_file_compare_locations(x, y);
+
+        return x->last_direction == DIRECTION_DOWN ? r : -r;
+}
+
+static int files_prioq_rebuild(sd_journal *j, direction_t direction) {
         unsigned i, n_files;
         const void **files;
-        Object *o;
         int r;
 
-        assert_return(j, -EINVAL);
-        assert_return(!journal_pid_changed(j), -ECHILD);
+        assert(j);
+
+        files_prioq_invalidate(j);
 
         r = iterated_cache_get(j->files_cache, NULL, &files, &n_files);
         if (r < 0)
                 return r;
 
+        r = prioq_ensure_allocated(&j->files_prioq, compare_file_locations);
+        if (r < 0)
+                return r;
+
+        r = set_ensure_allocated(&j->files_growing, NULL);
+        if (r < 0)
+                goto fail;
+
+        j->files_prioq_direction = direction;
+
         for (i = 0; i < n_files; i++) {
                 JournalFile *f = (JournalFile *)files[i];
-                bool found;
+                int k;
+
+                k = next_beyond_location(j, f, direction);
+                if (k < 0) {
+                        log_debug_errno(k, "Can't iterate through %s, ignoring: %m", f->path);
+                        remove_file_real(j, f);
+                        continue;
+                }
+
+                /* Archived files never change, hence only the others need to be looked at again once
+                 * they ran out of entries. */
+                if (f->header->state != STATE_ARCHIVED) {
+                        r = set_put(j->files_growing, f);
+                        if (r < 0)
+                                goto fail;
+                }
+
+                if (k == 0) {
+                        f->location_type = LOCATION_TAIL;
+                        continue;
+                }
+
+                r = prioq_put(j->files_prioq, f, &f->location_prioq_idx);
+                if (r < 0)
+                        goto fail;
+        }
+
+        return 0;
+
+fail:
+        files_prioq_invalidate(j);
+        return r;
+}
+
+static int files_prioq_advance(sd_journal *j, direction_t direction) {
+        JournalFile *f;
+        Iterator i;
+        int r;
+
+        assert(j);
+
+        /* The top of the queue is the file the current entry was taken from. Move it beyond that entry,
+         * and then keep validating the top, so that entries which exist in more than one file are
+         * suppressed, until it holds an entry that is actually beyond the current location. The other
+         * files already point to their candidates, so there's no need to look at them. */
+        while ((f = prioq_peek(j->files_prioq))) {
+                uint64_t offset = f->current_offset;
+                bool seek = f->location_type == LOCATION_SEEK;
 
                 r = next_beyond_location(j, f, direction);
                 if (r < 0) {
                         log_debug_errno(r, "Can't iterate through %s, ignoring: %m", f->path);
                         remove_file_real(j, f);
-                        continue;
-                } else if (r == 0) {
+                        return files_prioq_rebuild(j, direction);
+                }
+                if (r == 0) {
+                        assert_se(prioq_remove(j->files_prioq, f, &f->location_prioq_idx) > 0);
+                        f->location_prioq_idx = PRIOQ_IDX_NULL;
                         f->location_type = LOCATION_TAIL;
                         continue;
                 }
 
-                if (!new_file)
-                        found = true;
-                else {
-                        int k;
+                if (seek && f->current_offset == offset)
+                        break;
+
+                assert_se(prioq_reshuffle(j->files_prioq, f, &f->location_prioq_idx) >= 0);
+        }
 
-                        k = journal_file_compare_locations(f, new_file);
+        /* Files that ran out of entries might have gotten new ones in the meantime. */
+restart:
+        SET_FOREACH(f, j->files_growing, i) {
+                if (f->location_prioq_idx != PRIOQ_IDX_NULL)
+                        continue;
 
-                        found = direction == DIRECTION_DOWN ? k < 0 : k > 0;
+                r = next_beyond_location(j, f, direction);
+                if (r < 0) {
+                        log_debug_errno(r, "Can't iterate through %s, ignoring: %m", f->path);
+                        remove_file_real(j, f);
+                        goto restart;
+                }
+                if (r == 0) {
+                        f->location_type = LOCATION_TAIL;
+                        continue;
                 }
 
-                if (found)
-                        new_file = f;
+                r = prioq_put(j->files_prioq, f, &f->location_prioq_idx);
+                if (r < 0)
+                        return r;
         }
 
+        return 0;
+}
+
+static int real_journal_next(sd_journal *j, direction_t direction) {
+        JournalFile *new_file;
+        Object *o;
+        int r;
+
+        assert_return(j, -EINVAL);
+        assert_return(!journal_pid_changed(j), -ECHILD);
+
+        /* The files are merged through a priority queue ordered by their candidate entries, so that a
+         * step only has to look at the files whose candidates changed, instead of at all of them. The
+         * queue is built from all files whenever the location is reset, the direction changes or files
+         * are added. */
+        if (!j->files_prioq || j->files_prioq_direction != direction)
+                r = files_prioq_rebuild(j, direction);
+        else
+                r = files_prioq_advance(j, direction);
+        if (r < 0)
+                return r;
+
+        new_file = prioq_peek(j->files_prioq);
         if (!new_file)
                 return 0;
 
@@ -1340,6 +1485,7 @@ static int add_any_file(
         track_file_disposition(j, f);
         check_network(j, f->fd);
 
+        files_prioq_invalidate(j);
         j->current_invalidate_counter++;
 
         log_debug("File %s added.", f->path);
@@ -1404,6 +1550,11 @@ static void remove_file_real(sd_journal *j, JournalFile *f) {
         assert(j);
         assert(f);
 
+        if (f->location_prioq_idx != PRIOQ_IDX_NULL)
+                files_prioq_invalidate(j);
+        else
+                (void) set_remove(j->files_growing, f);
+
         (void) ordered_hashmap_remove(j->files, f->path);
 
         log_debug("File %s removed.", f->path);
@@ -2058,6 +2209,7 @@ _public_ void sd_journal_close(sd_journal *j) {
 
         sd_journal_flush_matches(j);
 
+        files_prioq_invalidate(j);
         ordered_hashmap_free_with_destructor(j->files, journal_file_close);
         iterated_cache_free(j->files_cache);
 
@@ -2073,7 +2225,7 @@ _public_ void sd_journal_close(sd_journal *j) {
         safe_close(j->inotify_fd);
 
         if (j->mmap) {
-                log_debug("mmap cache statistics: %u hit, %u miss", mmap_cache_get_hit(j->mmap), mmap_cache_get_missed(j->mmap));
+                mmap_cache_stats_log_debug(j->mmap);
                 mmap_cache_unref(j->mmap);
         }
 
@@ -2222,8 +2374,12 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
 
                 compression = o->object.flags & OBJECT_COMPRESSION_MASK;
                 if (compression) {
-#if HAVE_XZ || HAVE_LZ4
-                        r = decompress_startswith(compression,
+#if HAVE_COMPRESSION
+                        r = journal_file_load_dictionary(f);
+                        if (r < 0)
+                                return r;
+
+                        r = decompress_startswith(compression, f->compress_dictionary,
                                                   o->data.payload, l,
                                                   &f->compress_buffer, &f->compress_buffer_size,
                                                   field, field_length, '=');
@@ -2234,7 +2390,7 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
 
                                 size_t rsize;
 
-                                r = decompress_blob(compression,
+                                r = decompress_blob(compression, f->compress_dictionary,
                                                     o->data.payload, l,
                                                     &f->compress_buffer, &f->compress_buffer_size, &rsize,
                                                     j->data_threshold);
@@ -2286,11 +2442,15 @@ static int return_data(sd_journal *j, JournalFile *f, Object *o, const void **da
 
         compression = o->object.flags & OBJECT_COMPRESSION_MASK;
         if (compression) {
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_COMPRESSION
                 size_t rsize;
                 int r;
 
-                r = decompress_blob(compression,
+                r = journal_file_load_dictionary(f);
+                if (r < 0)
+                        return r;
+
+                r = decompress_blob(compression, f->compress_dictionary,
                                     o->data.payload, l, &f->compress_buffer,
                                     &f->compress_buffer_size, &rsize, j->data_threshold);
                 if (r < 0)
@@ -27,6 +27,12 @@
 # define LZ4_OK -EPROTONOSUPPORT
 #endif
 
+#if HAVE_ZSTD
+# define ZSTD_OK 0
+#else
+# define ZSTD_OK -EPROTONOSUPPORT
+#endif
+
 typedef int (compress_blob_t)(const void *src, uint64_t src_size,
                               void *dst, size_t dst_alloc_size, size_t *dst_size);
 typedef int (decompress_blob_t)(const void *src, uint64_t src_size,
@@ -40,7 +46,7 @@ typedef int (decompress_sw_t)(const void *src, uint64_t src_size,
 typedef int (compress_stream_t)(int fdf, int fdt, uint64_t max_bytes);
 typedef int (decompress_stream_t)(int fdf, int fdt, uint64_t max_size);
 
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_COMPRESSION
 static void test_compress_decompress(int compression,
                                      compress_blob_t compress,
                                      decompress_blob_t decompress,
@@ -238,8 +244,69 @@ static void test_lz4_decompress_partial(void) {
 }
 #endif
 
+#if HAVE_ZSTD
+static void test_zstd_dictionary(void) {
+        _cleanup_(compress_dictionary_freep) CompressDictionary *d = NULL, *other = NULL;
+        _cleanup_free_ char *samples = NULL, *decompressed = NULL;
+        size_t sample_sizes[2000], n = 0, csize, usize = 0, dsize;
+        char dictionary[4096], compressed[256];
+        const char *text = "MESSAGE=Accepted publickey for user42 from 192.168.0.42 port 4242 ssh2";
+        unsigned i;
+
+        log_info("/* testing ZSTD dictionary compression */");
+
+        samples = malloc(ELEMENTSOF(sample_sizes) * 128);
+        assert_se(samples);
+
+        for (i = 0; i < ELEMENTSOF(sample_sizes); i++) {
+                int k;
+
+                k = sprintf(samples + n, "MESSAGE=Accepted publickey for user%u from 192.168.%u.%u port %u ssh2",
+                            i % 50, i / 256, i % 256, 1024 + i * 7);
+                assert_se(k > 0);
+                sample_sizes[i] = k;
+                n += k;
+        }
+
+        assert_se(compress_dictionary_train(samples, sample_sizes, ELEMENTSOF(sample_sizes),
+                                            dictionary, sizeof(dictionary), &dsize) == 0);
+        assert_se(compress_dictionary_new(dictionary, dsize, &d) == 0);
+
+        /* Raw content without a dictionary ID is refused */
+        assert_se(compress_dictionary_new(text, strlen(text), &other) == -EBADMSG);
+
+        assert_se(compress_blob_zstd_dictionary(d, text, strlen(text), compressed, sizeof(compressed), &csize) == 0);
+        log_info("Compressed %zu → %zu bytes with a %zu byte dictionary", strlen(text), csize, dsize);
+        assert_se(csize < strlen(text));
+
+        assert_se(decompress_blob(OBJECT_COMPRESSED_ZSTD, d, compressed, csize,
+                                  (void**) &decompressed, &usize, &csize, 0) == 0);
+        assert_se(csize == strlen(text));
+        assert_se(memcmp(decompressed, text, csize) == 0);
+
+        assert_se(compress_blob_zstd_dictionary(d, text, strlen(text), compressed, sizeof(compressed), &csize) == 0);
+        assert_se(decompress_startswith(OBJECT_COMPRESSED_ZSTD, d, compressed, csize,
+                                        (void**) &decompressed, &usize, "MESSAGE", strlen("MESSAGE"), '=') > 0);
+        assert_se(decompress_startswith(OBJECT_COMPRESSED_ZSTD, d, compressed, csize,
+                                        (void**) &decompressed, &usize, "MESSAGE", strlen("MESSAGE"), 'x') == 0);
+
+        /* Without the dictionary the frame can't be decoded */
+        assert_se(decompress_blob(OBJECT_COMPRESSED_ZSTD, NULL, compressed, csize,
+                                  (void**) &decompressed, &usize, &dsize, 0) == -EBADMSG);
+        assert_se(decompress_startswith(OBJECT_COMPRESSED_ZSTD, NULL, compressed, csize,
+                                        (void**) &decompressed, &usize, "MESSAGE", strlen("MESSAGE"), '=') == -EBADMSG);
+
+        /* Frames compressed without a dictionary still decode fine when one is passed */
+        assert_se(compress_blob_zstd(text, strlen(text), compressed, sizeof(compressed), &csize) == 0);
+        assert_se(decompress_blob(OBJECT_COMPRESSED_ZSTD, d, compressed, csize,
+                                  (void**) &decompressed, &usize, &csize, 0) == 0);
+        assert_se(csize == strlen(text));
+        assert_se(memcmp(decompressed, text, csize) == 0);
+}
+#endif
+
 int main(int argc, char *argv[]) {
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_COMPRESSION
         const char text[] =
                 "text\0foofoofoofoo AAAA aaaaaaaaa ghost busters barbarbar FFF"
                 "foofoofoofoo AAAA aaaaaaaaa ghost busters barbarbar FFF";
@@ -304,9 +371,33 @@ int main(int argc, char *argv[]) {
         log_info("/* LZ4 test skipped */");
 #endif
 
+#if HAVE_ZSTD
+        test_compress_decompress(OBJECT_COMPRESSED_ZSTD, compress_blob_zstd, decompress_blob_zstd,
+                                 text, sizeof(text), false);
+        test_compress_decompress(OBJECT_COMPRESSED_ZSTD, compress_blob_zstd, decompress_blob_zstd,
+                                 data, sizeof(data), true);
+
+        test_decompress_startswith(OBJECT_COMPRESSED_ZSTD,
+                                   compress_blob_zstd, decompress_startswith_zstd,
+                                   text, sizeof(text), false);
+        test_decompress_startswith(OBJECT_COMPRESSED_ZSTD,
+                                   compress_blob_zstd, decompress_startswith_zstd,
+                                   data, sizeof(data), true);
+        test_decompress_startswith(OBJECT_COMPRESSED_ZSTD,
+                                   compress_blob_zstd, decompress_startswith_zstd,
+                                   huge, sizeof(huge), true);
+
+        test_compress_stream(OBJECT_COMPRESSED_ZSTD, "zstdcat",
+                             compress_stream_zstd, decompress_stream_zstd, srcfile);
+
+        test_zstd_dictionary();
+#else
+        log_info("/* ZSTD test skipped */");
+#endif
+
         return 0;
 #else
-        log_info("/* XZ and LZ4 tests skipped */");
+        log_info("/* XZ, LZ4 and ZSTD tests skipped */");
         return EXIT_TEST_SKIP;
 #endif
 }
@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+
+#include "alloc-util.h"
+#include "io-util.h"
+#include "journal-file.h"
+#include "macro.h"
+#include "parse-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "tests.h"
+#include "time-util.h"
+
+/* Appends entries to a journal file until it has grown to the specified size (128M by default), and
+ * prints how long appending an entry took on average for every 8M written. Most fields are the same in
+ * every entry, hence every entry is linked into ever growing entry array chains, and the time per entry
+ * should nonetheless stay flat. */
+
+#define STEP_SIZE (8ULL*1024ULL*1024ULL)
+
+static const char* const common_fields[] = {
+        "_HOSTNAME=localhost",
+        "_BOOT_ID=0123456789abcdef0123456789abcdef",
+        "_MACHINE_ID=fedcba9876543210fedcba9876543210",
+        "_TRANSPORT=journal",
+        "_UID=0",
+        "_GID=0",
+        "_COMM=test",
+        "_EXE=/usr/bin/test",
+        "_SYSTEMD_UNIT=test.service",
+        "_SYSTEMD_SLICE=system.slice",
+        "PRIORITY=6",
+        "SYSLOG_FACILITY=3",
+};
+
+static uint64_t file_size(JournalFile *f) {
+        return le64toh(f->header->tail_object_offset);
+}
+
+int main(int argc, char *argv[]) {
+        char t[] = "/var/tmp/test-journal-append-benchmark.XXXXXX";
+        struct iovec iovec[ELEMENTSOF(common_fields) + 2];
+        _cleanup_free_ char *fn = NULL;
+        uint64_t max_size = 128ULL*1024ULL*1024ULL, next = STEP_SIZE;
+        unsigned i, n = 0, k = 0;
+        JournalMetrics metrics;
+        JournalFile *f;
+        usec_t start;
+        int r;
+
+        test_setup_logging(LOG_INFO);
+
+        if (argc > 1)
+                assert_se(parse_size(argv[1], 1024, &max_size) >= 0);
+
+        assert_se(mkdtemp(t));
+        fn = strappend(t, "/test.journal");
+        assert_se(fn);
+
+        /* Size the hash tables like journald would for a file of this size */
+        journal_reset_metrics(&metrics);
+        metrics.max_size = max_size;
+        metrics.keep_free = 0;
+
+        assert_se(journal_file_open(-1, fn, O_RDWR|O_CREAT, 0644, true, (uint64_t) -1, false, &metrics, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < ELEMENTSOF(common_fields); i++)
+                iovec[i] = IOVEC_MAKE_STRING(common_fields[i]);
+
+        printf("%8s %12s %12s\n", "SIZE", "ENTRIES", "USEC/ENTRY");
+
+        start = now(CLOCK_MONOTONIC);
+
+        while (file_size(f) < max_size) {
+                char pid[STRLEN("_PID=") + DECIMAL_STR_MAX(unsigned)];
+                char message[STRLEN("MESSAGE=Test message number ") + DECIMAL_STR_MAX(unsigned)];
+
+                xsprintf(pid, "_PID=%u", n % 1000);
+                xsprintf(message, "MESSAGE=Test message number %u", n);
+                iovec[i] = IOVEC_MAKE_STRING(pid);
+                iovec[i+1] = IOVEC_MAKE_STRING(message);
+
+                r = journal_file_append_entry(f, NULL, NULL, iovec, ELEMENTSOF(iovec), NULL, NULL, NULL);
+                if (r == -E2BIG)
+                        break;
+                assert_se(r == 0);
+                n++;
+                k++;
+
+                if (file_size(f) >= next) {
+                        usec_t end;
+
+                        end = now(CLOCK_MONOTONIC);
+                        printf("%7"PRIu64"M %12u %12.3f\n", next / 1024 / 1024, n, (double) (end - start) / k);
+
+                        next += STEP_SIZE;
+                        k = 0;
+                        start = now(CLOCK_MONOTONIC);
+                }
+        }
+
+        (void) journal_file_close(f);
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        return 0;
+}
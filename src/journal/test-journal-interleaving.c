@@ -136,6 +136,7 @@ static void setup_interleaved(void) {
 static void test_skip(void (*setup)(void)) {
         char t[] = "/tmp/journal-skip-XXXXXX";
         sd_journal *j;
+        uint64_t realtime;
         int r;
 
         assert_se(mkdtemp(t));
@@ -177,6 +178,187 @@ static void test_skip(void (*setup)(void)) {
         test_check_numbers_up(j, 4);
         sd_journal_close(j);
 
+        /* Seek to the realtime of an entry, iterate down and up.
+         */
+        assert_ret(sd_journal_open_directory(&j, t, 0));
+        assert_ret(sd_journal_seek_head(j));
+        assert_ret(r = sd_journal_next_skip(j, 3));
+        assert_se(r == 3);
+        test_check_number(j, 3);
+        assert_ret(sd_journal_get_realtime_usec(j, &realtime));
+        assert_ret(sd_journal_seek_realtime_usec(j, realtime));
+        assert_ret(r = sd_journal_next(j));
+        assert_se(r == 1);
+        test_check_number(j, 3);
+        assert_ret(r = sd_journal_next(j));
+        assert_se(r == 1);
+        test_check_number(j, 4);
+        assert_ret(r = sd_journal_next(j));
+        assert_se(r == 0);
+        assert_ret(sd_journal_seek_realtime_usec(j, realtime - 1));
+        assert_ret(r = sd_journal_previous(j));
+        assert_se(r == 1);
+        test_check_number(j, 2);
+        sd_journal_close(j);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else {
+                journal_directory_vacuum(".", 3000000, 0, 0, NULL, true);
+
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+        }
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_next_number(sd_journal *j, int n) {
+        int r;
+
+        assert_ret(r = sd_journal_next(j));
+        assert_se(r == 1);
+        test_check_number(j, n);
+}
+
+static void test_previous_number(sd_journal *j, int n) {
+        int r;
+
+        assert_ret(r = sd_journal_previous(j));
+        assert_se(r == 1);
+        test_check_number(j, n);
+}
+
+static void test_check_end(sd_journal *j, direction_t direction) {
+        int r;
+
+        assert_ret(r = direction == DIRECTION_DOWN ? sd_journal_next(j) : sd_journal_previous(j));
+        assert_se(r == 0);
+}
+
+/* Spread the entries over three files unevenly, so that each file holds runs of varying length */
+#define MANY_ENTRIES 30
+#define MANY_FILE(n) (((n) + (n) / 4) % 3)
+
+static void test_many(void) {
+        char t[] = "/tmp/journal-many-XXXXXX";
+        _cleanup_free_ char *cursor = NULL;
+        JournalFile *one, *two, *three, *four;
+        JournalFile **files[] = { &one, &two, &three };
+        uint64_t realtime;
+        sd_journal *j;
+        int i;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        one = test_open("one.journal");
+        two = test_open("two.journal");
+        three = test_open("three.journal");
+
+        for (i = 1; i <= MANY_ENTRIES; i++)
+                append_number(*files[MANY_FILE(i)], i, NULL);
+
+        assert_ret(sd_journal_open_directory(&j, t, 0));
+
+        /* Set up inotify, so that sd_journal_process() notices added and removed files */
+        assert_ret(sd_journal_get_fd(j));
+
+        /* Iterate down from the head, and up from the tail.
+         */
+        assert_ret(sd_journal_seek_head(j));
+        for (i = 1; i <= MANY_ENTRIES; i++)
+                test_next_number(j, i);
+        test_check_end(j, DIRECTION_DOWN);
+
+        assert_ret(sd_journal_seek_tail(j));
+        for (i = MANY_ENTRIES; i >= 1; i--)
+                test_previous_number(j, i);
+        test_check_end(j, DIRECTION_UP);
+
+        /* Change direction a couple of times.
+         */
+        assert_ret(sd_journal_seek_head(j));
+        for (i = 1; i <= 10; i++)
+                test_next_number(j, i);
+        for (i = 9; i >= 5; i--)
+                test_previous_number(j, i);
+        for (i = 6; i <= 20; i++)
+                test_next_number(j, i);
+        test_previous_number(j, 19);
+        test_next_number(j, 20);
+
+        /* Seek into the middle by time and by cursor, and iterate in both directions from there.
+         */
+        assert_ret(sd_journal_get_realtime_usec(j, &realtime));
+        assert_ret(sd_journal_get_cursor(j, &cursor));
+
+        assert_ret(sd_journal_seek_head(j));
+        test_next_number(j, 1);
+        assert_ret(sd_journal_seek_realtime_usec(j, realtime));
+        test_next_number(j, 20);
+        test_next_number(j, 21);
+        assert_ret(sd_journal_seek_realtime_usec(j, realtime - 1));
+        test_previous_number(j, 19);
+        test_previous_number(j, 18);
+
+        assert_ret(sd_journal_seek_cursor(j, cursor));
+        test_previous_number(j, 20);
+        assert_se(sd_journal_test_cursor(j, cursor) > 0);
+        test_previous_number(j, 19);
+
+        assert_ret(sd_journal_seek_cursor(j, cursor));
+        test_next_number(j, 20);
+        assert_se(sd_journal_test_cursor(j, cursor) > 0);
+
+        /* Add a file while iterating, and append to that and an existing one: the new entries follow right
+         * after the ones we didn't get to yet.
+         */
+        four = test_open("four.journal");
+        for (i = MANY_ENTRIES + 1; i <= MANY_ENTRIES + 6; i++)
+                append_number(i % 2 == 0 ? four : one, i, NULL);
+        assert_ret(sd_journal_process(j));
+
+        for (i = 21; i <= MANY_ENTRIES + 6; i++)
+                test_next_number(j, i);
+        test_check_end(j, DIRECTION_DOWN);
+
+        /* Append to a file that ran out of entries while we weren't looking.
+         */
+        append_number(two, MANY_ENTRIES + 7, NULL);
+        assert_ret(sd_journal_process(j));
+        test_next_number(j, MANY_ENTRIES + 7);
+        test_check_end(j, DIRECTION_DOWN);
+
+        /* Remove a file while iterating: the entries of the others are still returned in order, in both
+         * directions.
+         */
+        assert_ret(sd_journal_seek_head(j));
+        for (i = 1; i <= 5; i++)
+                test_next_number(j, i);
+
+        test_close(three);
+        assert_se(unlink("three.journal") >= 0);
+        assert_ret(sd_journal_process(j));
+
+        for (i = 6; i <= MANY_ENTRIES + 7; i++)
+                if (i > MANY_ENTRIES || MANY_FILE(i) != 2)
+                        test_next_number(j, i);
+        test_check_end(j, DIRECTION_DOWN);
+
+        assert_ret(sd_journal_seek_tail(j));
+        for (i = MANY_ENTRIES + 7; i >= 1; i--)
+                if (i > MANY_ENTRIES || MANY_FILE(i) != 2)
+                        test_previous_number(j, i);
+        test_check_end(j, DIRECTION_UP);
+
+        sd_journal_close(j);
+
+        test_close(one);
+        test_close(two);
+        test_close(four);
+
         log_info("Done...");
 
         if (arg_keep)
@@ -285,6 +467,8 @@ int main(int argc, char *argv[]) {
         test_skip(setup_sequential);
         test_skip(setup_interleaved);
 
+        test_many();
+
         test_sequence_numbers();
 
         return 0;
@@ -3,11 +3,16 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include "sd-journal.h"
+
+#include "io-util.h"
 #include "journal-authenticate.h"
 #include "journal-file.h"
 #include "journal-vacuum.h"
+#include "journal-verify.h"
 #include "log.h"
 #include "rm-rf.h"
+#include "stdio-util.h"
 #include "tests.h"
 
 static bool arg_keep = false;
@@ -109,6 +114,122 @@ static void test_non_empty(void) {
         puts("------------------------------------------------------------");
 }
 
+#define N_BATCH_ENTRIES 500U
+
+static void test_append_batch(void) {
+        _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+        JournalBatch b = {};
+        JournalFile *f;
+        char t[] = "/tmp/journal-XXXXXX";
+        unsigned i, n, k = 0;
+        uint64_t seqnum = 0;
+        dual_timestamp ts;
+        int r;
+
+        test_setup_logging(LOG_INFO);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open(-1, "test.journal", O_RDWR|O_CREAT, 0666, true, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+
+        /* Append the entries in batches of growing size, so that the entry array chains get filled up
+         * across array boundaries in one go, and data objects show up repeatedly within a batch */
+        for (i = 0, n = 1; i < N_BATCH_ENTRIES; n++) {
+                for (; k < i + n && k < N_BATCH_ENTRIES; k++) {
+                        char message[32], foo[32];
+                        struct iovec iovec[3];
+
+                        xsprintf(message, "MESSAGE=batch %u", k);
+                        xsprintf(foo, "FOO=%u", k % 3);
+                        iovec[0] = IOVEC_MAKE_STRING(message);
+                        iovec[1] = IOVEC_MAKE_STRING(foo);
+                        iovec[2] = IOVEC_MAKE_STRING("COMMON=yes");
+
+                        assert_se(dual_timestamp_get(&ts));
+                        assert_se(journal_batch_add(&b, &ts, iovec, ELEMENTSOF(iovec)) >= 0);
+                }
+
+                /* An entry with an invalid timestamp is refused, the ones before it are written */
+                if (n == 7) {
+                        assert_se(journal_batch_add(&b, &(dual_timestamp) {}, NULL, 0) >= 0);
+
+                        assert_se(journal_file_append_batch(f, &b, &seqnum) == -EBADMSG);
+                        assert_se(b.n_written == b.n_entries - 1);
+                        assert_se(seqnum == k);
+
+                        b.n_written++;
+                }
+
+                assert_se(journal_file_append_batch(f, &b, &seqnum) >= 0);
+                assert_se(b.n_written == b.n_entries);
+                journal_batch_clear(&b);
+
+                i = k;
+        }
+
+        journal_batch_done(&b);
+
+        assert_se(seqnum == N_BATCH_ENTRIES);
+        assert_se(le64toh(f->header->n_entries) == N_BATCH_ENTRIES);
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false) >= 0);
+        (void) journal_file_close(f);
+
+        /* Everything reads back in order, also when looking up entries by their data */
+        assert_se(sd_journal_open_directory(&j, t, 0) >= 0);
+
+        i = 0;
+        SD_JOURNAL_FOREACH(j) {
+                char message[32];
+                const void *d;
+                size_t l;
+
+                xsprintf(message, "MESSAGE=batch %u", i);
+
+                r = sd_journal_get_data(j, "MESSAGE", &d, &l);
+                assert_se(r >= 0);
+                assert_se(l == strlen(message));
+                assert_se(memcmp(d, message, l) == 0);
+
+                i++;
+        }
+        assert_se(i == N_BATCH_ENTRIES);
+
+        assert_se(sd_journal_add_match(j, "FOO=1", 0) >= 0);
+
+        i = 0;
+        SD_JOURNAL_FOREACH(j) {
+                char message[32];
+                const void *d;
+                size_t l;
+
+                xsprintf(message, "MESSAGE=batch %u", i * 3 + 1);
+
+                r = sd_journal_get_data(j, "MESSAGE", &d, &l);
+                assert_se(r >= 0);
+                assert_se(l == strlen(message));
+                assert_se(memcmp(d, message, l) == 0);
+
+                i++;
+        }
+        assert_se(i == (N_BATCH_ENTRIES + 1) / 3);
+
+        sd_journal_flush_matches(j);
+        assert_se(sd_journal_add_match(j, "COMMON=yes", 0) >= 0);
+
+        i = 0;
+        SD_JOURNAL_FOREACH_BACKWARDS(j)
+                i++;
+        assert_se(i == N_BATCH_ENTRIES);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
 static void test_empty(void) {
         JournalFile *f1, *f2, *f3, *f4;
         char t[] = "/tmp/journal-XXXXXX";
@@ -151,7 +272,7 @@ static void test_empty(void) {
         (void) journal_file_close(f4);
 }
 
-#if HAVE_XZ || HAVE_LZ4
+#if HAVE_COMPRESSION
 static bool check_compressed(uint64_t compress_threshold, uint64_t data_size) {
         dual_timestamp ts;
         JournalFile *f;
@@ -236,6 +357,109 @@ static void test_min_compress_size(void) {
 }
 #endif
 
+#if HAVE_ZSTD
+#define N_DICTIONARY_ENTRIES 4000U
+
+static void dictionary_message(unsigned i, char *buf, size_t size) {
+        assert_se(snprintf(buf, size,
+                           "MESSAGE=pam_unix(sshd:session): session opened for user user%u(uid=%u) by (uid=0) from 10.0.%u.%u",
+                           i % 97, 1000 + i % 97, i / 256, i % 256) < (int) size);
+}
+
+static void append_dictionary_entries(JournalFile *f, unsigned from, unsigned to) {
+        dual_timestamp ts;
+        unsigned i;
+
+        for (i = from; i < to; i++) {
+                char message[256], pid[DECIMAL_STR_MAX(unsigned) + 5];
+                struct iovec iovec[2];
+
+                dictionary_message(i, message, sizeof(message));
+                xsprintf(pid, "_PID=%u", 10000 + i);
+
+                iovec[0] = IOVEC_MAKE_STRING(message);
+                iovec[1] = IOVEC_MAKE_STRING(pid);
+
+                dual_timestamp_get(&ts);
+                assert_se(journal_file_append_entry(f, &ts, NULL, iovec, ELEMENTSOF(iovec), NULL, NULL, NULL) == 0);
+        }
+}
+
+static void test_dictionary(void) {
+        _cleanup_(sd_journal_closep) sd_journal *j = NULL;
+        JournalFile *f;
+        uint64_t p, dictionary_offset, n_compressed = 0;
+        char t[] = "/tmp/journal-XXXXXX";
+        unsigned i = 0;
+        Object *o;
+        int r;
+
+        test_setup_logging(LOG_INFO);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        /* Write enough small data objects to get the dictionary trained */
+        assert_se(journal_file_open(-1, "test.journal", O_RDWR|O_CREAT, 0666, true, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+        assert_se(JOURNAL_HEADER_COMPRESSED_ZSTD_DICT(f->header));
+
+        append_dictionary_entries(f, 0, N_DICTIONARY_ENTRIES / 2);
+        assert_se(f->compress_dictionary);
+        dictionary_offset = le64toh(f->header->dictionary_offset);
+        assert_se(dictionary_offset > 0);
+        (void) journal_file_close(f);
+
+        /* When appending to the file again, it continues to use the same dictionary */
+        assert_se(journal_file_open(-1, "test.journal", O_RDWR, 0666, true, (uint64_t) -1, false, NULL, NULL, NULL, NULL, &f) == 0);
+        append_dictionary_entries(f, N_DICTIONARY_ENTRIES / 2, N_DICTIONARY_ENTRIES);
+        assert_se(le64toh(f->header->dictionary_offset) == dictionary_offset);
+
+        /* All data objects are smaller than the compression threshold, hence any compressed ones were
+         * compressed with the dictionary */
+        p = le64toh(f->header->header_size);
+        for (;;) {
+                assert_se(journal_file_move_to_object(f, OBJECT_UNUSED, p, &o) == 0);
+                if (o->object.type == OBJECT_DATA && (o->object.flags & OBJECT_COMPRESSED_ZSTD))
+                        n_compressed++;
+
+                if (p == le64toh(f->header->tail_object_offset))
+                        break;
+                p = p + ALIGN64(le64toh(o->object.size));
+        }
+
+        log_info("%"PRIu64" data objects compressed with a dictionary", n_compressed);
+        assert_se(n_compressed > N_DICTIONARY_ENTRIES / 4);
+
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false) >= 0);
+        (void) journal_file_close(f);
+
+        /* Everything reads back fine */
+        assert_se(sd_journal_open_directory(&j, t, 0) >= 0);
+        SD_JOURNAL_FOREACH(j) {
+                char message[256];
+                const void *d;
+                size_t l;
+
+                dictionary_message(i, message, sizeof(message));
+
+                r = sd_journal_get_data(j, "MESSAGE", &d, &l);
+                assert_se(r >= 0);
+                assert_se(l == strlen(message));
+                assert_se(memcmp(d, message, l) == 0);
+
+                i++;
+        }
+        assert_se(i == N_DICTIONARY_ENTRIES);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+#endif
+
 int main(int argc, char *argv[]) {
         arg_keep = argc > 1;
 
@@ -247,9 +471,13 @@ int main(int argc, char *argv[]) {
 
         test_non_empty();
         test_empty();
-#if HAVE_XZ || HAVE_LZ4
+        test_append_batch();
+#if HAVE_COMPRESSION
         test_min_compress_size();
 #endif
+#if HAVE_ZSTD
+        test_dictionary();
+#endif
 
         return 0;
 }
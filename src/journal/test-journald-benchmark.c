@@ -0,0 +1,343 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <stdio.h>
+#include <sys/wait.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "sd-id128.h"
+#include "sd-journal.h"
+
+#include "alloc-util.h"
+#include "dirent-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "macro.h"
+#include "parse-util.h"
+#include "process-util.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "tests.h"
+#include "time-util.h"
+#include "util.h"
+
+/* Drives the running journald with messages from a number of concurrent clients, using the native protocol, the
+ * syslog socket, stdout streams and large messages (which are passed as memfds) in turn, and reads them back from the
+ * journal afterwards. Reports the rate at which journald ingested them, how many were dropped, the latency from
+ * sending a message until journald wrote it, and how much CPU time journald spent per message.
+ *
+ * Note that journald rate limits messages per unit, hence consider setting RateLimitBurst=0 in journald.conf for
+ * measuring throughput. */
+
+#define LARGE_SIZE (1024U*1024U)
+
+/* Consider messages not seen after this long lost */
+#define SETTLE_USEC (5*USEC_PER_SEC)
+
+typedef enum Transport {
+        TRANSPORT_NATIVE,
+        TRANSPORT_SYSLOG,
+        TRANSPORT_STREAM,
+        TRANSPORT_LARGE,
+        _TRANSPORT_MAX,
+} Transport;
+
+static const char* const transport_table[_TRANSPORT_MAX] = {
+        [TRANSPORT_NATIVE] = "native",
+        [TRANSPORT_SYSLOG] = "syslog",
+        [TRANSPORT_STREAM] = "stream",
+        [TRANSPORT_LARGE] = "large",
+};
+
+typedef struct Stats {
+        char identifier[STRLEN("test-journald-benchmark--") + 6 + 8 + 1];
+        unsigned n_sent;
+        unsigned n_received;
+        usec_t *latencies;
+} Stats;
+
+static unsigned arg_clients = 8;
+static unsigned arg_messages = 10000;
+
+static unsigned n_messages(Transport t) {
+        /* Large messages are expensive, send fewer of them */
+        return t == TRANSPORT_LARGE ? MAX(arg_messages / 100, 1U) : arg_messages;
+}
+
+static void client(Transport t, const char *identifier) {
+        _cleanup_free_ char *large = NULL;
+        _cleanup_close_ int fd = -1;
+        unsigned i;
+
+        switch (t) {
+
+        case TRANSPORT_SYSLOG:
+                openlog(identifier, LOG_NDELAY, LOG_USER);
+                break;
+
+        case TRANSPORT_STREAM:
+                fd = sd_journal_stream_fd(identifier, LOG_INFO, false);
+                assert_se(fd >= 0);
+                break;
+
+        case TRANSPORT_LARGE:
+                large = new(char, LARGE_SIZE + 1);
+                assert_se(large);
+                memset(large, 'x', LARGE_SIZE);
+                large[LARGE_SIZE] = 0;
+                break;
+
+        default:
+                break;
+        }
+
+        for (i = 0; i < n_messages(t); i++) {
+                usec_t ts;
+
+                ts = now(CLOCK_REALTIME);
+
+                switch (t) {
+
+                case TRANSPORT_NATIVE:
+                        assert_se(sd_journal_send("MESSAGE=" USEC_FMT, ts,
+                                                  "SYSLOG_IDENTIFIER=%s", identifier,
+                                                  NULL) >= 0);
+                        break;
+
+                case TRANSPORT_SYSLOG:
+                        syslog(LOG_INFO, USEC_FMT, ts);
+                        break;
+
+                case TRANSPORT_STREAM:
+                        assert_se(dprintf(fd, USEC_FMT "\n", ts) >= 0);
+                        break;
+
+                case TRANSPORT_LARGE:
+                        assert_se(sd_journal_send("MESSAGE=" USEC_FMT, ts,
+                                                  "SYSLOG_IDENTIFIER=%s", identifier,
+                                                  "LARGE=%s", large,
+                                                  NULL) >= 0);
+                        break;
+
+                default:
+                        assert_not_reached("Unknown transport");
+                }
+        }
+}
+
+static pid_t find_journald(void) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+
+        d = opendir("/proc");
+        if (!d)
+                return 0;
+
+        FOREACH_DIRENT(de, d, return 0) {
+                _cleanup_free_ char *comm = NULL;
+                pid_t pid;
+
+                if (parse_pid(de->d_name, &pid) < 0)
+                        continue;
+
+                if (get_process_comm(pid, &comm) < 0)
+                        continue;
+
+                if (streq(comm, "systemd-journal"))
+                        return pid;
+        }
+
+        return 0;
+}
+
+static usec_t process_cpu_usec(pid_t pid) {
+        _cleanup_free_ char *line = NULL;
+        unsigned long utime, stime;
+        const char *p, *fn;
+
+        if (pid <= 0)
+                return USEC_INFINITY;
+
+        fn = procfs_file_alloca(pid, "stat");
+        if (read_one_line_file(fn, &line) < 0)
+                return USEC_INFINITY;
+
+        /* Skip past the comm field, which might contain spaces */
+        p = strrchr(line, ')');
+        if (!p)
+                return USEC_INFINITY;
+
+        if (sscanf(p + 2,
+                   "%*c "  /* state */
+                   "%*s "  /* ppid */
+                   "%*s "  /* pgrp */
+                   "%*s "  /* session */
+                   "%*s "  /* tty_nr */
+                   "%*s "  /* tpgid */
+                   "%*s "  /* flags */
+                   "%*s "  /* minflt */
+                   "%*s "  /* cminflt */
+                   "%*s "  /* majflt */
+                   "%*s "  /* cmajflt */
+                   "%lu "  /* utime */
+                   "%lu ", /* stime */
+                   &utime, &stime) != 2)
+                return USEC_INFINITY;
+
+        return (usec_t) (utime + stime) * USEC_PER_SEC / sysconf(_SC_CLK_TCK);
+}
+
+static int usec_compare(const void *a, const void *b) {
+        const usec_t *x = a, *y = b;
+
+        return CMP(*x, *y);
+}
+
+static usec_t percentile(usec_t *l, unsigned n, unsigned p) {
+        if (n == 0)
+                return 0;
+
+        return l[(n - 1) * p / 100];
+}
+
+int main(int argc, char *argv[]) {
+        char p50[FORMAT_TIMESPAN_MAX], p99[FORMAT_TIMESPAN_MAX], span[FORMAT_TIMESPAN_MAX];
+        Stats stats[_TRANSPORT_MAX] = {};
+        unsigned i, n_sent = 0, n_received = 0;
+        usec_t start, last = 0, cpu_start, cpu_end;
+        char id[SD_ID128_STRING_MAX];
+        sd_journal *j;
+        sd_id128_t rnd;
+        pid_t journald;
+        Transport t;
+        int r;
+
+        test_setup_logging(LOG_INFO);
+
+        if (argc > 1)
+                assert_se(safe_atou(argv[1], &arg_clients) >= 0);
+        if (argc > 2)
+                assert_se(safe_atou(argv[2], &arg_messages) >= 0);
+
+        assert_se(arg_clients > 0);
+
+        assert_se(sd_id128_randomize(&rnd) >= 0);
+        sd_id128_to_string(rnd, id);
+
+        assert_se(sd_journal_open(&j, SD_JOURNAL_LOCAL_ONLY) >= 0);
+
+        for (t = 0; t < _TRANSPORT_MAX; t++) {
+                char m[STRLEN("SYSLOG_IDENTIFIER=") + sizeof(stats[t].identifier)];
+
+                xsprintf(stats[t].identifier, "test-journald-benchmark-%s-%.8s", transport_table[t], id);
+                xsprintf(m, "SYSLOG_IDENTIFIER=%s", stats[t].identifier);
+                assert_se(sd_journal_add_match(j, m, 0) >= 0);
+        }
+
+        for (i = 0; i < arg_clients; i++)
+                stats[i % _TRANSPORT_MAX].n_sent += n_messages(i % _TRANSPORT_MAX);
+
+        for (t = 0; t < _TRANSPORT_MAX; t++) {
+                stats[t].latencies = new(usec_t, stats[t].n_sent);
+                assert_se(stats[t].latencies || stats[t].n_sent == 0);
+                n_sent += stats[t].n_sent;
+        }
+
+        journald = find_journald();
+        cpu_start = process_cpu_usec(journald);
+        start = now(CLOCK_REALTIME);
+
+        for (i = 0; i < arg_clients; i++) {
+                pid_t pid;
+
+                pid = fork();
+                assert_se(pid >= 0);
+
+                if (pid == 0) {
+                        t = i % _TRANSPORT_MAX;
+                        client(t, stats[t].identifier);
+                        _exit(EXIT_SUCCESS);
+                }
+        }
+
+        for (i = 0; i < arg_clients; i++) {
+                int status;
+
+                assert_se(wait(&status) > 0);
+                assert_se(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+        }
+
+        /* Collect what made it into the journal. Stop waiting once everything arrived, or nothing new appeared for a
+         * while. */
+        for (;;) {
+                const void *d;
+                usec_t sent, written;
+                size_t l;
+                char *k;
+
+                r = sd_journal_next(j);
+                assert_se(r >= 0);
+                if (r == 0) {
+                        if (n_received >= n_sent)
+                                break;
+
+                        r = sd_journal_wait(j, SETTLE_USEC);
+                        assert_se(r >= 0);
+                        if (r == SD_JOURNAL_NOP)
+                                break;
+
+                        continue;
+                }
+
+                assert_se(sd_journal_get_data(j, "SYSLOG_IDENTIFIER", &d, &l) >= 0);
+
+                for (t = 0; t < _TRANSPORT_MAX; t++)
+                        if (l == STRLEN("SYSLOG_IDENTIFIER=") + strlen(stats[t].identifier) &&
+                            memcmp((const char*) d + STRLEN("SYSLOG_IDENTIFIER="), stats[t].identifier, strlen(stats[t].identifier)) == 0)
+                                break;
+                assert_se(t < _TRANSPORT_MAX);
+
+                assert_se(sd_journal_get_realtime_usec(j, &written) >= 0);
+                assert_se(sd_journal_get_data(j, "MESSAGE", &d, &l) >= 0);
+                assert_se(k = strndup((const char*) d + STRLEN("MESSAGE="), l - STRLEN("MESSAGE=")));
+                assert_se(safe_atou64(k, &sent) >= 0);
+                free(k);
+
+                assert_se(stats[t].n_received < stats[t].n_sent);
+                stats[t].latencies[stats[t].n_received++] = LESS_BY(written, sent);
+                n_received++;
+
+                last = MAX(last, written);
+        }
+
+        cpu_end = process_cpu_usec(journald);
+
+        printf("%-10s %10s %10s %10s %12s %12s\n", "TRANSPORT", "SENT", "RECEIVED", "DROPPED", "P50", "P99");
+
+        for (t = 0; t < _TRANSPORT_MAX; t++) {
+                qsort_safe(stats[t].latencies, stats[t].n_received, sizeof(usec_t), usec_compare);
+
+                printf("%-10s %10u %10u %10u %12s %12s\n",
+                       transport_table[t],
+                       stats[t].n_sent,
+                       stats[t].n_received,
+                       stats[t].n_sent - stats[t].n_received,
+                       format_timespan(p50, sizeof(p50), percentile(stats[t].latencies, stats[t].n_received, 50), 1),
+                       format_timespan(p99, sizeof(p99), percentile(stats[t].latencies, stats[t].n_received, 99), 1));
+
+                free(stats[t].latencies);
+        }
+
+        printf("\n%u of %u messages from %u clients ingested in %s",
+               n_received, n_sent, arg_clients,
+               format_timespan(span, sizeof(span), LESS_BY(last, start), 1));
+        if (last > start)
+                printf(", %.0f messages/s", (double) n_received * USEC_PER_SEC / (last - start));
+        if (n_received > 0 && cpu_start != USEC_INFINITY && cpu_end != USEC_INFINITY)
+                printf(", %.1f us of journald CPU time per message", (double) (cpu_end - cpu_start) / n_received);
+        printf(".\n");
+
+        sd_journal_close(j);
+
+        return 0;
+}
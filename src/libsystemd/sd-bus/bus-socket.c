@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: LGPL-2.1+ */
 
 #include <endian.h>
+#include <limits.h>
 #include <poll.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -25,12 +26,16 @@
 #include "signal-util.h"
 #include "stdio-util.h"
 #include "string-util.h"
+#include "unaligned.h"
 #include "user-util.h"
 #include "utf8.h"
 #include "util.h"
 
 #define SNDBUF_SIZE (8*1024*1024)
 
+/* How much to read at least in one go on connections that don't pass fds */
+#define READ_SIZE_MIN (16U*1024U)
+
 static void iovec_advance(struct iovec iov[], unsigned *idx, size_t size) {
 
         while (size > 0) {
@@ -965,18 +970,21 @@ int bus_socket_take_fd(sd_bus *b) {
         return bus_socket_start_auth(b);
 }
 
-int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
+int bus_socket_write_messages(sd_bus *bus, sd_bus_message **q, unsigned n, size_t *idx) {
+        sd_bus_message *m;
         struct iovec *iov;
+        unsigned i, j, n_iovec;
         ssize_t k;
-        size_t n;
-        unsigned j;
         int r;
 
         assert(bus);
-        assert(m);
+        assert(q);
+        assert(n > 0);
         assert(idx);
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
+        m = q[0];
+
         if (*idx >= BUS_MESSAGE_SIZE(m))
                 return 0;
 
@@ -984,19 +992,41 @@ int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
         if (r < 0)
                 return r;
 
-        n = m->n_iovec * sizeof(struct iovec);
-        iov = alloca(n);
-        memcpy_safe(iov, m->iovec, n);
+        n_iovec = m->n_iovec;
+
+        /* Write as many of the following messages as possible along with the first one. The receiving side
+         * attributes fds to the message whose first byte it reads them with, hence fds may only be sent with
+         * the first message of a batch, and we need to stop before the next message that carries any. Any
+         * errors are left for when the message in question is the first one. */
+        for (i = 1; i < n; i++) {
+                if (q[i]->n_fds > 0)
+                        break;
+
+                if (bus_message_setup_iovec(q[i]) < 0)
+                        break;
+
+                if (n_iovec + q[i]->n_iovec > IOV_MAX)
+                        break;
+
+                n_iovec += q[i]->n_iovec;
+        }
+        n = i;
+
+        iov = newa(struct iovec, n_iovec);
+        for (i = 0, j = 0; i < n; i++) {
+                memcpy_safe(iov + j, q[i]->iovec, q[i]->n_iovec * sizeof(struct iovec));
+                j += q[i]->n_iovec;
+        }
 
         j = 0;
         iovec_advance(iov, &j, *idx);
 
         if (bus->prefer_writev)
-                k = writev(bus->output_fd, iov, m->n_iovec);
+                k = writev(bus->output_fd, iov, n_iovec);
         else {
                 struct msghdr mh = {
                         .msg_iov = iov,
-                        .msg_iovlen = m->n_iovec,
+                        .msg_iovlen = n_iovec,
                 };
 
                 if (m->n_fds > 0 && *idx == 0) {
@@ -1012,7 +1042,7 @@ int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
                 k = sendmsg(bus->output_fd, &mh, MSG_DONTWAIT|MSG_NOSIGNAL);
                 if (k < 0 && errno == ENOTSOCK) {
                         bus->prefer_writev = true;
-                        k = writev(bus->output_fd, iov, m->n_iovec);
+                        k = writev(bus->output_fd, iov, n_iovec);
                 }
         }
 
@@ -1023,16 +1053,22 @@ int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
         return 1;
 }
 
-static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
+int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
+        return bus_socket_write_messages(bus, &m, 1, idx);
+}
+
+static int bus_socket_read_message_need(sd_bus *bus, size_t offset, size_t *need) {
+        const uint8_t *p;
         uint32_t a, b;
         uint8_t e;
         uint64_t sum;
 
         assert(bus);
+        assert(bus->rbuffer_size >= offset);
         assert(need);
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
-        if (bus->rbuffer_size < sizeof(struct bus_header)) {
+        if (bus->rbuffer_size - offset < sizeof(struct bus_header)) {
                 *need = sizeof(struct bus_header) + 8;
 
                 /* Minimum message size:
@@ -1054,16 +1090,16 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
                 return 0;
         }
 
-        a = ((const uint32_t*) bus->rbuffer)[1];
-        b = ((const uint32_t*) bus->rbuffer)[3];
+        /* Messages following others in the buffer are not necessarily aligned */
+        p = (const uint8_t*) bus->rbuffer + offset;
 
-        e = ((const uint8_t*) bus->rbuffer)[0];
+        e = p[0];
         if (e == BUS_LITTLE_ENDIAN) {
-                a = le32toh(a);
-                b = le32toh(b);
+                a = unaligned_read_le32(p + 4);
+                b = unaligned_read_le32(p + 12);
         } else if (e == BUS_BIG_ENDIAN) {
-                a = be32toh(a);
-                b = be32toh(b);
+                a = unaligned_read_be32(p + 4);
+                b = unaligned_read_be32(p + 12);
         } else
                 return -EBADMSG;
 
@@ -1075,39 +1111,49 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
         return 0;
 }
 
-static int bus_socket_make_message(sd_bus *bus, size_t size) {
+static int bus_socket_make_message(sd_bus *bus, size_t offset, size_t size) {
         sd_bus_message *t;
+        bool take;
         void *b;
         int r;
 
         assert(bus);
-        assert(bus->rbuffer_size >= size);
+        assert(bus->rbuffer_size >= offset + size);
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
         r = bus_rqueue_make_room(bus);
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size > size) {
-                b = memdup((const uint8_t*) bus->rbuffer + size,
-                           bus->rbuffer_size - size);
+        /* If the message is all there is in the buffer, it takes over the buffer (trimmed to size, as we might
+         * have allocated more for reading), otherwise it gets a copy */
+        take = offset == 0 && bus->rbuffer_size == size;
+        if (take) {
+                b = realloc(bus->rbuffer, size);
+                if (b)
+                        bus->rbuffer = b;
+                b = bus->rbuffer;
+        } else {
+                b = memdup((const uint8_t*) bus->rbuffer + offset, size);
                 if (!b)
                         return -ENOMEM;
-        } else
-                b = NULL;
+        }
 
         r = bus_message_from_malloc(bus,
-                                    bus->rbuffer, size,
+                                    b, size,
                                     bus->fds, bus->n_fds,
                                     NULL,
                                     &t);
         if (r < 0) {
-                free(b);
+                if (!take)
+                        free(b);
                 return r;
         }
 
-        bus->rbuffer = b;
-        bus->rbuffer_size -= size;
+        if (take) {
+                bus->rbuffer = NULL;
+                bus->rbuffer_size = 0;
+        }
 
         bus->fds = NULL;
         bus->n_fds = 0;
@@ -1117,11 +1163,56 @@ static int bus_socket_make_message(sd_bus *bus, size_t size) {
         return 1;
 }
 
+static int bus_socket_make_messages(sd_bus *bus) {
+        size_t offset = 0, need;
+        int r, ret = 0;
+
+        assert(bus);
+
+        /* Turns all complete messages in the read buffer into message objects. We won't be woken up by the
+         * socket for the data we already read, hence we can't leave any of them for later. */
+
+        for (;;) {
+                r = bus_socket_read_message_need(bus, offset, &need);
+                if (r < 0)
+                        break;
+
+                if (bus->rbuffer_size - offset < need) {
+                        r = ret;
+                        break;
+                }
+
+                r = bus_socket_make_message(bus, offset, need);
+                if (r < 0)
+                        break;
+
+                ret = 1;
+
+                if (!bus->rbuffer)
+                        return ret;
+
+                offset += need;
+        }
+
+        if (offset > 0) {
+                bus->rbuffer_size -= offset;
+
+                /* Don't keep the read-ahead buffer around if nothing is left in it, it's
+                 * allocated again when we read the next time. */
+                if (bus->rbuffer_size == 0)
+                        bus->rbuffer = mfree(bus->rbuffer);
+                else
+                        memmove(bus->rbuffer, (uint8_t*) bus->rbuffer + offset, bus->rbuffer_size);
+        }
+
+        return r;
+}
+
 int bus_socket_read_message(sd_bus *bus) {
         struct msghdr mh;
         struct iovec iov = {};
         ssize_t k;
-        size_t need;
+        size_t need, size;
         int r;
         void *b;
         union {
@@ -1133,21 +1224,28 @@ int bus_socket_read_message(sd_bus *bus) {
         assert(bus);
         assert(IN_SET(bus->state, BUS_RUNNING, BUS_HELLO));
 
-        r = bus_socket_read_message_need(bus, &need);
+        r = bus_socket_read_message_need(bus, 0, &need);
         if (r < 0)
                 return r;
 
         if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
+                return bus_socket_make_messages(bus);
+
+        /* If no fds are passed on this connection, read more than we need for the message at hand if it is
+         * available already, so that we can process a burst of messages with few syscalls. Otherwise we stop
+         * exactly at the message boundary, since we couldn't tell which message fds read along belong to.
+         * Note that fd passing is negotiated by default on AF_UNIX sockets, hence most local connections,
+         * for example those to PID 1 or the bus broker, don't read ahead. */
+        size = bus->can_fds ? need : MAX(need, bus->rbuffer_size + READ_SIZE_MIN);
 
-        b = realloc(bus->rbuffer, need);
+        b = realloc(bus->rbuffer, size);
         if (!b)
                 return -ENOMEM;
 
         bus->rbuffer = b;
 
         iov.iov_base = (uint8_t*) bus->rbuffer + bus->rbuffer_size;
-        iov.iov_len = need - bus->rbuffer_size;
+        iov.iov_len = size - bus->rbuffer_size;
 
         if (bus->prefer_readv)
                 k = readv(bus->input_fd, &iov, 1);
@@ -1205,12 +1303,12 @@ int bus_socket_read_message(sd_bus *bus) {
                                           cmsg->cmsg_level, cmsg->cmsg_type);
         }
 
-        r = bus_socket_read_message_need(bus, &need);
+        r = bus_socket_read_message_need(bus, 0, &need);
         if (r < 0)
                 return r;
 
         if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
+                return bus_socket_make_messages(bus);
 
         return 1;
 }
@@ -15,7 +15,12 @@
 
 #define MAX_SIZE (2*1024*1024)
 
+/* Flush the write queue when it has grown to this many messages while sending a burst */
+#define BURST_QUEUE_MAX 1024U
+
 static usec_t arg_loop_usec = 100 * USEC_PER_MSEC;
+static bool arg_fds = true;
+static uint64_t n_burst = 0;
 
 typedef enum Type {
         TYPE_LEGACY,
@@ -47,6 +52,13 @@ static void server(sd_bus *b, size_t *result) {
 
                         r = sd_bus_reply_method_return(m, NULL);
                         assert_se(r >= 0);
+                } else if (sd_bus_message_is_signal(m, "benchmark.server", "Burst")) {
+                        const void *p;
+                        size_t sz;
+
+                        assert_se(sd_bus_message_read_array(m, 'y', &p, &sz) > 0);
+                        n_burst++;
+
                 } else if (sd_bus_message_is_method_call(m, "benchmark.server", "Exit")) {
                         uint64_t res;
                         assert_se(sd_bus_message_read(m, "t", &res) > 0);
@@ -145,6 +157,88 @@ static void client_bisect(const char *address, const char *server_name) {
         sd_bus_unref(b);
 }
 
+static void client_burst(Type type, const char *address, const char *server_name, int fd) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *x = NULL;
+        uint64_t n_sent = 0;
+        size_t csize;
+        sd_bus *b;
+        int r;
+
+        /* Sends signals as fast as possible, without waiting for anything in between, like PID1 does when
+         * lots of units change state at the same time */
+
+        r = sd_bus_new(&b);
+        assert_se(r >= 0);
+
+        r = sd_bus_negotiate_fds(b, arg_fds);
+        assert_se(r >= 0);
+
+        if (type == TYPE_DIRECT) {
+                r = sd_bus_set_fd(b, fd, fd);
+                assert_se(r >= 0);
+        } else {
+                r = sd_bus_set_address(b, address);
+                assert_se(r >= 0);
+
+                r = sd_bus_set_bus_client(b, true);
+                assert_se(r >= 0);
+        }
+
+        r = sd_bus_start(b);
+        assert_se(r >= 0);
+
+        r = sd_bus_call_method(b, server_name, "/", "benchmark.server", "Ping", NULL, NULL, NULL);
+        assert_se(r >= 0);
+
+        printf("SIZE\tMESSAGES/S\n");
+
+        for (csize = 1; csize <= 64*1024; csize *= 4) {
+                usec_t t, n;
+                unsigned n_burst_sent;
+
+                printf("%zu\t", csize);
+
+                t = now(CLOCK_MONOTONIC);
+                for (n_burst_sent = 0;;) {
+                        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+                        uint64_t n_queued;
+                        uint8_t *p;
+
+                        assert_se(sd_bus_message_new_signal(b, &m, "/", "benchmark.server", "Burst") >= 0);
+                        if (server_name)
+                                assert_se(sd_bus_message_set_destination(m, server_name) >= 0);
+                        assert_se(sd_bus_message_append_array_space(m, 'y', csize, (void**) &p) >= 0);
+                        memset(p, 0x80, csize);
+
+                        assert_se(sd_bus_send(b, m, NULL) >= 0);
+                        n_burst_sent++;
+
+                        assert_se(sd_bus_get_n_queued_write(b, &n_queued) >= 0);
+                        if (n_queued >= BURST_QUEUE_MAX)
+                                assert_se(sd_bus_flush(b) >= 0);
+
+                        if (n_burst_sent % 64 == 0 && now(CLOCK_MONOTONIC) >= t + arg_loop_usec)
+                                break;
+                }
+
+                /* Everything was processed once the reply to this arrives */
+                r = sd_bus_call_method(b, server_name, "/", "benchmark.server", "Ping", NULL, NULL, NULL);
+                assert_se(r >= 0);
+
+                n = now(CLOCK_MONOTONIC) - t;
+                n_sent += n_burst_sent;
+
+                printf("%u\n", (unsigned) (n_burst_sent * USEC_PER_SEC / n));
+        }
+
+        assert_se(sd_bus_message_new_method_call(b, &x, server_name, "/", "benchmark.server", "Exit") >= 0);
+        assert_se(sd_bus_message_append(x, "t", n_sent) >= 0);
+        assert_se(sd_bus_send(b, x, NULL) >= 0);
+        assert_se(sd_bus_flush(b) >= 0);
+
+        sd_bus_unref(b);
+}
+
 static void client_chart(Type type, const char *address, const char *server_name, int fd) {
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *x = NULL;
         size_t csize;
@@ -208,6 +302,7 @@ int main(int argc, char *argv[]) {
         enum {
                 MODE_BISECT,
                 MODE_CHART,
+                MODE_BURST,
         } mode = MODE_BISECT;
         Type type = TYPE_LEGACY;
         int i, pair[2] = { -1, -1 };
@@ -224,6 +319,12 @@ int main(int argc, char *argv[]) {
                 if (streq(argv[i], "chart")) {
                         mode = MODE_CHART;
                         continue;
+                } else if (streq(argv[i], "burst")) {
+                        mode = MODE_BURST;
+                        continue;
+                } else if (streq(argv[i], "nofds")) {
+                        arg_fds = false;
+                        continue;
                 } else if (streq(argv[i], "legacy")) {
                         type = TYPE_LEGACY;
                         continue;
@@ -250,6 +351,9 @@ int main(int argc, char *argv[]) {
         r = sd_bus_new(&b);
         assert_se(r >= 0);
 
+        r = sd_bus_negotiate_fds(b, arg_fds);
+        assert_se(r >= 0);
+
         if (type == TYPE_DIRECT) {
                 assert_se(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) >= 0);
 
@@ -299,8 +403,13 @@ int main(int argc, char *argv[]) {
                 case MODE_CHART:
                         client_chart(type, address, server_name, pair[1]);
                         break;
+
+                case MODE_BURST:
+                        client_burst(type, address, server_name, pair[1]);
+                        break;
                 }
 
+                fflush(stdout);
                 _exit(EXIT_SUCCESS);
         }
 
@@ -312,6 +421,8 @@ int main(int argc, char *argv[]) {
 
         if (mode == MODE_BISECT)
                 printf("Copying/memfd are equally fast at %zu bytes\n", result);
+        else if (mode == MODE_BURST)
+                assert_se(n_burst == result);
 
         assert_se(waitpid(pid, NULL, 0) == pid);
 
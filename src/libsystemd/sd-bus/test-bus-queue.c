@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "sd-bus.h"
+
+#include "bus-internal.h"
+#include "fd-util.h"
+#include "io-util.h"
+#include "log.h"
+#include "macro.h"
+#include "random-util.h"
+#include "string-util.h"
+
+/* Sends a lot of messages of random size through a socket with a tiny send buffer, so that they pile up in
+ * the write queue and are written and read in batches, and verifies that they arrive in order and intact,
+ * and that fds stay attached to the right messages. */
+
+#define N_MESSAGES 3000U
+#define PAYLOAD_MAX 8000U
+#define FD_EVERY 7U
+#define QUEUE_MAX 64U
+
+struct context {
+        int fds[2];
+        bool negotiate_fds;
+        uint64_t max_queued;
+};
+
+static void fill_payload(uint8_t *p, size_t l, uint32_t i) {
+        size_t j;
+
+        for (j = 0; j < l; j++)
+                p[j] = (uint8_t) (i * 31 + j);
+}
+
+static void *client(void *p) {
+        struct context *c = p;
+        _cleanup_(sd_bus_flush_close_unrefp) sd_bus *bus = NULL;
+        uint8_t payload[PAYLOAD_MAX];
+        int sz = 1, r;
+        uint32_t i;
+
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, c->fds[1], c->fds[1]) >= 0);
+        assert_se(sd_bus_negotiate_fds(bus, c->negotiate_fds) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        /* The kernel rounds this up to its minimum */
+        assert_se(setsockopt(c->fds[1], SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz)) >= 0);
+
+        for (i = 0; i < N_MESSAGES; i++) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+                size_t l;
+                uint64_t q;
+
+                l = random_u64() % PAYLOAD_MAX;
+                fill_payload(payload, l, i);
+
+                assert_se(sd_bus_message_new_signal(bus, &m, "/", "org.freedesktop.systemd.test", "Queue") >= 0);
+
+                if (c->negotiate_fds && i % FD_EVERY == 0) {
+                        _cleanup_close_pair_ int pipe_fds[2] = { -1, -1 };
+
+                        /* Pass the read end of a pipe along that contains the message index, so that the
+                         * receiver can tell whether it got the right fd */
+                        assert_se(pipe2(pipe_fds, O_CLOEXEC) >= 0);
+                        assert_se(loop_write(pipe_fds[1], &i, sizeof(i), false) >= 0);
+
+                        assert_se(sd_bus_message_append(m, "uh", i, pipe_fds[0]) >= 0);
+                } else
+                        assert_se(sd_bus_message_append(m, "u", i) >= 0);
+
+                assert_se(sd_bus_message_append_array(m, 'y', payload, l) >= 0);
+                assert_se(sd_bus_send(bus, m, NULL) >= 0);
+
+                assert_se(sd_bus_get_n_queued_write(bus, &q) >= 0);
+                c->max_queued = MAX(c->max_queued, q);
+
+                if (q >= QUEUE_MAX) {
+                        r = sd_bus_flush(bus);
+                        assert_se(r >= 0);
+                }
+        }
+
+        assert_se(sd_bus_flush(bus) >= 0);
+
+        return NULL;
+}
+
+static void test_queue(bool negotiate_fds) {
+        _cleanup_(sd_bus_unrefp) sd_bus *bus = NULL;
+        struct context c = {
+                .negotiate_fds = negotiate_fds,
+        };
+        uint8_t payload[PAYLOAD_MAX];
+        uint32_t expected = 0;
+        sd_id128_t id;
+        pthread_t t;
+        int sz = 1, r;
+
+        log_info("/* %s(%s) */", __func__, yes_no(negotiate_fds));
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, c.fds) >= 0);
+        assert_se(setsockopt(c.fds[0], SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz)) >= 0);
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, c.fds[0], c.fds[0]) >= 0);
+        assert_se(sd_bus_set_server(bus, true, id) >= 0);
+        assert_se(sd_bus_negotiate_fds(bus, negotiate_fds) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        assert_se(pthread_create(&t, NULL, client, &c) == 0);
+
+        while (expected < N_MESSAGES) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+                const void *p;
+                size_t l;
+                uint32_t i;
+
+                r = sd_bus_process(bus, &m);
+                assert_se(r >= 0);
+                if (r == 0) {
+                        assert_se(sd_bus_wait(bus, (uint64_t) -1) >= 0);
+                        continue;
+                }
+                if (!m || !sd_bus_message_is_signal(m, "org.freedesktop.systemd.test", "Queue"))
+                        continue;
+
+                assert_se(sd_bus_message_read(m, "u", &i) >= 0);
+                assert_se(i == expected);
+
+                if (negotiate_fds && i % FD_EVERY == 0) {
+                        uint32_t j;
+                        int fd;
+
+                        assert_se(sd_bus_message_read(m, "h", &fd) > 0);
+                        assert_se(loop_read_exact(fd, &j, sizeof(j), false) >= 0);
+                        assert_se(j == i);
+                }
+
+                assert_se(sd_bus_message_read_array(m, 'y', &p, &l) >= 0);
+                assert_se(l < PAYLOAD_MAX);
+                fill_payload(payload, l, i);
+                assert_se(memcmp(p, payload, l) == 0);
+
+                assert_se(sd_bus_message_at_end(m, true) > 0);
+
+                expected++;
+        }
+
+        assert_se(pthread_join(t, NULL) == 0);
+
+        log_info("Received %" PRIu32 " messages, up to %" PRIu64 " were queued for writing.", expected, c.max_queued);
+}
+
+int main(int argc, char *argv[]) {
+        log_parse_environment();
+        log_open();
+
+        test_queue(false);
+        test_queue(true);
+
+        return 0;
+}
@@ -100,9 +100,14 @@ struct sd_event_source {
         unsigned prepare_index;
         uint64_t pending_iteration;
         uint64_t prepare_iteration;
+        uint64_t dispatch_iteration;
 
         sd_event_destroy_t destroy_callback;
 
+        /* When the source became pending, and what dispatching it cost so far */
+        usec_t pending_since;
+        sd_event_source_statistics statistics;
+
         LIST_FIELDS(sd_event_source, sources);
 
         union {
@@ -264,6 +269,7 @@ struct sd_event {
 
         Hashmap *child_sources;
         unsigned n_enabled_child_sources;
+        unsigned n_child_sources_stopped_continued; /* child sources that care for more than WEXITED */
 
         Set *post_sources;
 
@@ -285,6 +291,7 @@ struct sd_event {
 
         bool exit_requested:1;
         bool need_process_child:1;
+        bool need_process_child_on_reap:1;
         bool watchdog:1;
         bool profile_delays:1;
 
@@ -297,10 +304,14 @@ struct sd_event {
 
         unsigned n_sources;
 
+        /* The maximum number of sources of the same priority to dispatch per iteration */
+        unsigned dispatch_budget;
+
         LIST_HEAD(sd_event_source, sources);
 
         usec_t last_run, last_log;
         unsigned delays[sizeof(usec_t) * 8];
+        unsigned n_dispatched;
 };
 
 static thread_local sd_event *default_event = NULL;
@@ -502,6 +513,7 @@ _public_ int sd_event_new(sd_event** ret) {
                 .boottime_alarm.next = USEC_INFINITY,
                 .perturb = USEC_INFINITY,
                 .original_pid = getpid_cached(),
+                .dispatch_budget = 1,
         };
 
         r = prioq_ensure_allocated(&e->pending, pending_prioq_compare);
@@ -886,6 +898,16 @@ static void source_disconnect(sd_event_source *s) {
                                 s->event->n_enabled_child_sources--;
                         }
 
+                        /* If process_child() only peeked at this child, nobody will look for further exited
+                         * children once it is reaped, hence do so right away. */
+                        if (s->pending && s->event->need_process_child_on_reap)
+                                s->event->need_process_child = true;
+
+                        if (s->child.options & (WSTOPPED|WCONTINUED)) {
+                                assert(s->event->n_child_sources_stopped_continued > 0);
+                                s->event->n_child_sources_stopped_continued--;
+                        }
+
                         (void) hashmap_remove(s->event->child_sources, PID_TO_PTR(s->child.pid));
                         event_gc_signal_data(s->event, &s->priority, SIGCHLD);
                 }
@@ -989,6 +1011,7 @@ static int source_set_pending(sd_event_source *s, bool b) {
 
         if (b) {
                 s->pending_iteration = s->event->iteration;
+                s->pending_since = now(CLOCK_MONOTONIC);
 
                 r = prioq_put(s->event->pending, s, &s->pending_index);
                 if (r < 0) {
@@ -1344,6 +1367,8 @@ _public_ int sd_event_add_child(
                 return r;
 
         e->n_enabled_child_sources++;
+        if (options & (WSTOPPED|WCONTINUED))
+                e->n_child_sources_stopped_continued++;
 
         r = event_make_signal_data(e, SIGCHLD, NULL);
         if (r < 0) {
@@ -2165,6 +2190,10 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
 
         if (m == SD_EVENT_OFF) {
 
+                /* See source_disconnect() */
+                if (s->type == SOURCE_CHILD && s->pending && s->event->need_process_child_on_reap)
+                        s->event->need_process_child = true;
+
                 /* Unset the pending flag when this event source is disabled */
                 if (!IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT)) {
                         r = source_set_pending(s, false);
@@ -2692,6 +2721,42 @@ static int process_child(sd_event *e) {
         assert(e);
 
         e->need_process_child = false;
+        e->need_process_child_on_reap = false;
+
+        /* If all we are interested in are exiting children, first peek at the first zombie among our children
+         * with P_ALL, without reaping it. If it is one we watch and haven't seen yet, we are done: it is
+         * dispatched and reaped next, after which we check again for the next one. This way the work done
+         * per SIGCHLD is proportional to the number of exited children, not to the number of watched ones. If
+         * there is no zombie at all, there's nothing to do either. Otherwise (the zombie isn't ours, or we
+         * already know about it, or is disabled) we can't look past it, and need to fall back to checking each
+         * child individually below. */
+        if (e->n_child_sources_stopped_continued == 0) {
+                siginfo_t si = {};
+
+                if (waitid(P_ALL, 0, &si, WEXITED|WNOHANG|WNOWAIT) < 0) {
+                        if (errno == ECHILD) /* No children at all */
+                                return 0;
+
+                        return -errno;
+                }
+
+                if (si.si_pid == 0)
+                        return 0;
+
+                s = hashmap_get(e->child_sources, PID_TO_PTR(si.si_pid));
+                if (s && !s->pending && s->enabled != SD_EVENT_OFF) {
+                        assert(s->type == SOURCE_CHILD);
+
+                        s->child.siginfo = si;
+
+                        r = source_set_pending(s, true);
+                        if (r < 0)
+                                return r;
+
+                        e->need_process_child_on_reap = true;
+                        return 0;
+                }
+        }
 
         /*
            So, this is ugly. We iteratively invoke waitid() with P_PID
@@ -2964,8 +3029,28 @@ static int process_inotify(sd_event *e) {
         return done;
 }
 
+static void source_account_dispatch(sd_event_source *s, usec_t pending_usec, usec_t start) {
+        usec_t n, dispatch_usec;
+
+        assert(s);
+
+        n = now(CLOCK_MONOTONIC);
+        dispatch_usec = usec_sub_unsigned(n, start);
+
+        s->statistics.n_dispatched++;
+        s->statistics.dispatch_usec += dispatch_usec;
+        s->statistics.dispatch_usec_max = MAX(s->statistics.dispatch_usec_max, dispatch_usec);
+        s->statistics.pending_usec += pending_usec;
+        s->statistics.pending_usec_max = MAX(s->statistics.pending_usec_max, pending_usec);
+
+        /* Defer sources stay pending while enabled, count from here on for the next dispatch */
+        if (s->pending)
+                s->pending_since = n;
+}
+
 static int source_dispatch(sd_event_source *s) {
         EventSourceType saved_type;
+        usec_t start, pending_usec = 0;
         int r = 0;
 
         assert(s);
@@ -2975,6 +3060,12 @@ static int source_dispatch(sd_event_source *s) {
          * the event. */
         saved_type = s->type;
 
+        start = now(CLOCK_MONOTONIC);
+        if (s->pending)
+                pending_usec = usec_sub_unsigned(start, s->pending_since);
+
+        s->dispatch_iteration = s->event->iteration;
+
         if (!IN_SET(s->type, SOURCE_DEFER, SOURCE_EXIT)) {
                 r = source_set_pending(s, false);
                 if (r < 0)
@@ -3025,6 +3116,7 @@ static int source_dispatch(sd_event_source *s) {
                 break;
 
         case SOURCE_CHILD: {
+                sd_event *e = s->event; /* The callback might disconnect the source */
                 bool zombie;
 
                 zombie = IN_SET(s->child.siginfo.si_code, CLD_EXITED, CLD_KILLED, CLD_DUMPED);
@@ -3032,9 +3124,15 @@ static int source_dispatch(sd_event_source *s) {
                 r = s->child.callback(s, &s->child.siginfo, s->userdata);
 
                 /* Now, reap the PID for good. */
-                if (zombie)
+                if (zombie) {
                         (void) waitid(P_PID, s->child.pid, &s->child.siginfo, WNOHANG|WEXITED);
 
+                        /* If process_child() only peeked at this child, more might have exited in the meantime,
+                         * but we got only a single SIGCHLD for all of them. Look at the next one now. */
+                        if (e->need_process_child_on_reap)
+                                e->need_process_child = true;
+                }
+
                 break;
         }
 
@@ -3080,6 +3178,8 @@ static int source_dispatch(sd_event_source *s) {
 
         s->dispatching = false;
 
+        source_account_dispatch(s, pending_usec, start);
+
         if (r < 0)
                 log_debug_errno(r, "Event source %s (type %s) returned error, disabling: %m",
                                 strna(s->description), event_source_type_to_string(saved_type));
@@ -3419,10 +3519,36 @@ _public_ int sd_event_dispatch(sd_event *e) {
         p = event_next_pending(e);
         if (p) {
                 _cleanup_(sd_event_unrefp) sd_event *ref = NULL;
+                int64_t priority;
+                unsigned n = 0;
 
                 ref = sd_event_ref(e);
                 e->state = SD_EVENT_RUNNING;
-                r = source_dispatch(p);
+
+                /* Dispatch further pending sources of the same priority within the same iteration, up to the
+                 * configured budget, saving us the trip through sd_event_prepare() and epoll_wait() for each of
+                 * them. Stop as soon as a source of a different priority is next or exiting was requested. Also
+                 * stop if the next source was already dispatched in this iteration: enabled defer sources stay
+                 * pending after being dispatched, and post sources are made pending again by every other source
+                 * we dispatch, but each source is dispatched at most once per iteration. Note that we don't poll
+                 * for new events in between, hence IO, signal, child and timer events of higher priority that
+                 * occur meanwhile are only noticed once we are done here, i.e. they might have to wait for up to
+                 * budget-1 further dispatches. */
+                priority = p->priority;
+                for (;;) {
+                        r = source_dispatch(p);
+                        e->n_dispatched++;
+                        if (r < 0)
+                                break;
+
+                        if (++n >= e->dispatch_budget || e->exit_requested)
+                                break;
+
+                        p = event_next_pending(e);
+                        if (!p || p->priority != priority || p->dispatch_iteration == e->iteration)
+                                break;
+                }
+
                 e->state = SD_EVENT_INITIAL;
                 return r;
         }
@@ -3434,14 +3560,16 @@ _public_ int sd_event_dispatch(sd_event *e) {
 
 static void event_log_delays(sd_event *e) {
         char b[ELEMENTSOF(e->delays) * DECIMAL_STR_MAX(unsigned) + 1];
-        unsigned i;
+        unsigned i, n = 0;
         int o;
 
         for (i = o = 0; i < ELEMENTSOF(e->delays); i++) {
                 o += snprintf(&b[o], sizeof(b) - o, "%u ", e->delays[i]);
+                n += e->delays[i];
                 e->delays[i] = 0;
         }
-        log_debug("Event loop iterations: %.*s", o, b);
+        log_debug("Event loop iterations: %.*s(%u sources dispatched in %u iterations)", o, b, e->n_dispatched, n);
+        e->n_dispatched = 0;
 }
 
 _public_ int sd_event_run(sd_event *e, uint64_t timeout) {
@@ -3687,6 +3815,41 @@ _public_ int sd_event_get_iteration(sd_event *e, uint64_t *ret) {
         return 0;
 }
 
+_public_ int sd_event_set_dispatch_budget(sd_event *e, unsigned budget) {
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        e->dispatch_budget = MAX(budget, 1U);
+        return 0;
+}
+
+_public_ int sd_event_get_dispatch_budget(sd_event *e, unsigned *ret) {
+        assert_return(e, -EINVAL);
+        assert_return(e = event_resolve(e), -ENOPKG);
+        assert_return(ret, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        *ret = e->dispatch_budget;
+        return 0;
+}
+
+_public_ int sd_event_source_get_statistics(sd_event_source *s, sd_event_source_statistics *ret, size_t size) {
+        size_t n;
+
+        assert_return(s, -EINVAL);
+        assert_return(ret, -EINVAL);
+        assert_return(!event_pid_changed(s->event), -ECHILD);
+
+        /* The caller passes the size of the structure it was compiled with. Only fill in as much of it as it
+         * knows about, and zero out whatever we don't know about. */
+        n = MIN(size, sizeof(s->statistics));
+        memcpy(ret, &s->statistics, n);
+        memzero((uint8_t*) ret + n, size - n);
+
+        return 0;
+}
+
 _public_ int sd_event_source_set_destroy_callback(sd_event_source *s, sd_event_destroy_t callback) {
         assert_return(s, -EINVAL);
 
@@ -12,6 +12,7 @@
 #include "macro.h"
 #include "parse-util.h"
 #include "process-util.h"
+#include "random-util.h"
 #include "rm-rf.h"
 #include "signal-util.h"
 #include "stdio-util.h"
@@ -481,12 +482,380 @@ static void test_inotify(unsigned n_create_events) {
         sd_event_unref(e);
 }
 
+static int child_many_handler(sd_event_source *s, const siginfo_t *si, void *userdata) {
+        unsigned *n_left = userdata;
+
+        assert_se(s);
+        assert_se(si);
+
+        assert_se(si->si_code == CLD_EXITED);
+        assert_se(si->si_status == 42);
+
+        assert_se(*n_left > 0);
+        if (--(*n_left) == 0)
+                assert_se(sd_event_exit(sd_event_source_get_event(s), 0) >= 0);
+
+        return 1;
+}
+
+static void test_child_many(unsigned n_children) {
+        _cleanup_free_ sd_event_source **sources = NULL;
+        unsigned i, n_left = n_children;
+        pid_t unwatched;
+        sd_event *e;
+
+        assert_se(sigprocmask_many(SIG_BLOCK, NULL, SIGCHLD, -1) >= 0);
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sources = new(sd_event_source*, n_children));
+
+        for (i = 0; i < n_children; i++) {
+                siginfo_t si = {};
+                pid_t pid;
+
+                pid = fork();
+                assert_se(pid >= 0);
+
+                if (pid == 0)
+                        _exit(42);
+
+                assert_se(sd_event_add_child(e, &sources[i], pid, WEXITED, child_many_handler, &n_left) >= 0);
+
+                /* Wait until the child exited, without reaping it, so that the SIGCHLDs are coalesced */
+                assert_se(waitid(P_PID, pid, &si, WEXITED|WNOWAIT) >= 0);
+        }
+
+        /* And one more child we don't watch, which must be left alone */
+        unwatched = fork();
+        assert_se(unwatched >= 0);
+
+        if (unwatched == 0)
+                _exit(EXIT_SUCCESS);
+
+        assert_se(sd_event_loop(e) >= 0);
+        assert_se(n_left == 0);
+
+        assert_se(wait_for_terminate_and_check("unwatched", unwatched, 0) == EXIT_SUCCESS);
+
+        for (i = 0; i < n_children; i++)
+                sd_event_source_unref(sources[i]);
+
+        sd_event_unref(e);
+}
+
+static int time_many_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        unsigned *n_left = userdata;
+
+        assert_se(*n_left > 0);
+        (*n_left)--;
+
+        return 0;
+}
+
+static void test_time_many(unsigned n_timers) {
+        _cleanup_free_ sd_event_source **sources = NULL;
+        unsigned i, n_left = 0;
+        usec_t base, t[5];
+        sd_event *e;
+
+        /* Adds lots of timers in the future, moves all of them, cancels half of them and lets the others fire,
+         * and logs how long each step took per timer */
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sources = new(sd_event_source*, n_timers));
+        assert_se(sd_event_now(e, CLOCK_MONOTONIC, &base) >= 0);
+
+        t[0] = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n_timers; i++)
+                assert_se(sd_event_add_time(e, &sources[i], CLOCK_MONOTONIC,
+                                            base + USEC_PER_HOUR + random_u64() % USEC_PER_HOUR, 0,
+                                            time_many_handler, &n_left) >= 0);
+
+        t[1] = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n_timers; i++)
+                assert_se(sd_event_source_set_time(sources[i], base + USEC_PER_HOUR + random_u64() % USEC_PER_HOUR) >= 0);
+
+        t[2] = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n_timers; i += 2)
+                sources[i] = sd_event_source_unref(sources[i]);
+
+        t[3] = now(CLOCK_MONOTONIC);
+
+        for (i = 1; i < n_timers; i += 2) {
+                assert_se(sd_event_source_set_time(sources[i], 1) >= 0);
+                n_left++;
+        }
+
+        while (n_left > 0)
+                assert_se(sd_event_run(e, 0) > 0);
+
+        t[4] = now(CLOCK_MONOTONIC);
+
+        /* The cancelled ones must not fire either */
+        assert_se(sd_event_run(e, 0) == 0);
+
+        log_info("%u timers: add %.3fus, modify %.3fus, cancel %.3fus, fire %.3fus per timer",
+                 n_timers,
+                 (double) (t[1] - t[0]) / n_timers,
+                 (double) (t[2] - t[1]) / n_timers,
+                 (double) (t[3] - t[2]) / (n_timers / 2),
+                 (double) (t[4] - t[3]) / (n_timers / 2));
+
+        for (i = 0; i < n_timers; i++)
+                sd_event_source_unref(sources[i]);
+
+        sd_event_unref(e);
+}
+
+static int child_pending_handler(sd_event_source *s, const siginfo_t *si, void *userdata) {
+        unsigned *n = userdata;
+
+        assert_se(si->si_code == CLD_EXITED);
+        (*n)++;
+
+        return 0;
+}
+
+static void test_child_disable_pending(bool unref) {
+        sd_event_source *sources[3];
+        pid_t pids[3];
+        unsigned i, n = 0, k = ELEMENTSOF(sources);
+        sd_event *e;
+        int r;
+
+        /* Several children exit at once, and the source of the one we are told about first is disabled or
+         * unref'd before it is dispatched. The other ones must still be noticed, without another SIGCHLD. */
+
+        assert_se(sigprocmask_many(SIG_BLOCK, NULL, SIGCHLD, -1) >= 0);
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        for (i = 0; i < ELEMENTSOF(sources); i++) {
+                siginfo_t si = {};
+
+                pids[i] = fork();
+                assert_se(pids[i] >= 0);
+
+                if (pids[i] == 0)
+                        _exit(42);
+
+                assert_se(sd_event_add_child(e, &sources[i], pids[i], WEXITED, child_pending_handler, &n) >= 0);
+                assert_se(waitid(P_PID, pids[i], &si, WEXITED|WNOWAIT) >= 0);
+        }
+
+        r = sd_event_prepare(e);
+        assert_se(r >= 0);
+        if (r == 0)
+                assert_se(sd_event_wait(e, USEC_INFINITY) > 0);
+
+        for (i = 0; i < ELEMENTSOF(sources); i++)
+                if (sd_event_source_get_pending(sources[i]) > 0) {
+                        if (unref)
+                                sources[i] = sd_event_source_unref(sources[i]);
+                        else
+                                assert_se(sd_event_source_set_enabled(sources[i], SD_EVENT_OFF) >= 0);
+
+                        k = i;
+                        break;
+                }
+        assert_se(k < ELEMENTSOF(sources));
+
+        assert_se(sd_event_dispatch(e) >= 0);
+
+        while (n < ELEMENTSOF(sources) - 1)
+                assert_se(sd_event_run(e, 5 * USEC_PER_SEC) > 0);
+
+        assert_se(wait_for_terminate_and_check("child", pids[k], 0) == 42);
+
+        for (i = 0; i < ELEMENTSOF(sources); i++)
+                sd_event_source_unref(sources[i]);
+
+        sd_event_unref(e);
+}
+
+static unsigned n_batch_low = 0, n_batch_normal = 0, n_batch_high = 0;
+static sd_event_source *batch_high = NULL;
+
+static int batch_handler(sd_event_source *s, void *userdata) {
+        unsigned *n = userdata;
+
+        (*n)++;
+
+        /* The first source of normal priority makes one of higher priority pending, which must end the batch */
+        if (n == &n_batch_normal && *n == 1)
+                assert_se(sd_event_source_set_enabled(batch_high, SD_EVENT_ONESHOT) >= 0);
+
+        return 1;
+}
+
+static unsigned n_batch_always = 0, n_batch_post = 0, n_batch_deferred = 0;
+static sd_event_source *batch_deferred = NULL;
+
+static int batch_post_handler(sd_event_source *s, void *userdata) {
+        n_batch_post++;
+
+        /* Make a source pending that is dispatched after us in the same batch, and hence makes us pending
+         * again */
+        if (n_batch_post == 1)
+                assert_se(sd_event_source_set_enabled(batch_deferred, SD_EVENT_ONESHOT) >= 0);
+
+        return 1;
+}
+
+static void test_dispatch_budget(void) {
+        sd_event_source *sources[6];
+        uint64_t iteration, last;
+        unsigned budget, i;
+        sd_event *e;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        assert_se(sd_event_get_dispatch_budget(e, &budget) >= 0);
+        assert_se(budget == 1);
+
+        assert_se(sd_event_set_dispatch_budget(e, 3) >= 0);
+        assert_se(sd_event_get_dispatch_budget(e, &budget) >= 0);
+        assert_se(budget == 3);
+
+        for (i = 0; i < 5; i++)
+                assert_se(sd_event_add_defer(e, &sources[i], batch_handler, &n_batch_normal) >= 0);
+
+        assert_se(sd_event_add_defer(e, &sources[5], batch_handler, &n_batch_low) >= 0);
+        assert_se(sd_event_source_set_priority(sources[5], 10) >= 0);
+
+        assert_se(sd_event_add_defer(e, &batch_high, batch_handler, &n_batch_high) >= 0);
+        assert_se(sd_event_source_set_priority(batch_high, -10) >= 0);
+        assert_se(sd_event_source_set_enabled(batch_high, SD_EVENT_OFF) >= 0);
+
+        assert_se(sd_event_get_iteration(e, &last) >= 0);
+
+        /* The first source enables the one of higher priority, which is dispatched on its own next */
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(n_batch_normal == 1 && n_batch_high == 0 && n_batch_low == 0);
+
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(n_batch_normal == 1 && n_batch_high == 1 && n_batch_low == 0);
+
+        /* Then the remaining four normal ones, at most three per iteration, and never together with the low one */
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(n_batch_normal == 4 && n_batch_low == 0);
+
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(n_batch_normal == 5 && n_batch_low == 0);
+
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(n_batch_normal == 5 && n_batch_low == 1);
+
+        assert_se(sd_event_get_iteration(e, &iteration) >= 0);
+        assert_se(iteration - last == 5);
+
+        assert_se(sd_event_run(e, 0) == 0);
+
+        for (i = 0; i < ELEMENTSOF(sources); i++)
+                sources[i] = sd_event_source_unref(sources[i]);
+        batch_high = sd_event_source_unref(batch_high);
+
+        /* A defer source that stays enabled remains pending after it was dispatched, but is still only
+         * dispatched once per iteration */
+        assert_se(sd_event_add_defer(e, &sources[0], batch_handler, &n_batch_always) >= 0);
+        assert_se(sd_event_source_set_enabled(sources[0], SD_EVENT_ON) >= 0);
+
+        for (i = 1; i <= 3; i++) {
+                assert_se(sd_event_run(e, 0) > 0);
+                assert_se(n_batch_always == i);
+        }
+
+        sources[0] = sd_event_source_unref(sources[0]);
+
+        /* The same goes for post sources, which every other dispatched source makes pending again */
+        assert_se(sd_event_set_dispatch_budget(e, 5) >= 0);
+        assert_se(sd_event_add_defer(e, &sources[0], batch_handler, &n_batch_normal) >= 0);
+        assert_se(sd_event_add_defer(e, &batch_deferred, batch_handler, &n_batch_deferred) >= 0);
+        assert_se(sd_event_source_set_enabled(batch_deferred, SD_EVENT_OFF) >= 0);
+        assert_se(sd_event_add_post(e, &sources[1], batch_post_handler, NULL) >= 0);
+
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(n_batch_normal == 6 && n_batch_post == 1 && n_batch_deferred == 1);
+
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(n_batch_post == 2);
+
+        assert_se(sd_event_run(e, 0) == 0);
+
+        for (i = 0; i < 2; i++)
+                sd_event_source_unref(sources[i]);
+        batch_deferred = sd_event_source_unref(batch_deferred);
+
+        sd_event_unref(e);
+}
+
+static int statistics_handler(sd_event_source *s, void *userdata) {
+        assert_se(usleep(10 * USEC_PER_MSEC) >= 0);
+        return 0;
+}
+
+static void test_statistics(void) {
+        sd_event_source_statistics st;
+        uint64_t buf[sizeof(st) / sizeof(uint64_t) + 2];
+        sd_event_source *s;
+        sd_event *e;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_add_defer(e, &s, statistics_handler, NULL) >= 0);
+
+        assert_se(sd_event_source_get_statistics(s, &st, sizeof(st)) >= 0);
+        assert_se(st.n_dispatched == 0 && st.dispatch_usec == 0 && st.pending_usec == 0);
+
+        /* The source is pending right away, but only dispatched after this */
+        assert_se(usleep(5 * USEC_PER_MSEC) >= 0);
+
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(sd_event_source_get_statistics(s, &st, sizeof(st)) >= 0);
+        assert_se(st.n_dispatched == 1);
+        assert_se(st.dispatch_usec >= 10 * USEC_PER_MSEC);
+        assert_se(st.dispatch_usec_max == st.dispatch_usec);
+        assert_se(st.pending_usec >= 5 * USEC_PER_MSEC);
+        assert_se(st.pending_usec_max == st.pending_usec);
+
+        assert_se(sd_event_source_set_enabled(s, SD_EVENT_ONESHOT) >= 0);
+        assert_se(sd_event_run(e, 0) > 0);
+        assert_se(sd_event_source_get_statistics(s, &st, sizeof(st)) >= 0);
+        assert_se(st.n_dispatched == 2);
+        assert_se(st.dispatch_usec >= 20 * USEC_PER_MSEC);
+        assert_se(st.dispatch_usec_max <= st.dispatch_usec);
+        assert_se(st.pending_usec_max <= st.pending_usec);
+
+        /* Callers built against an older version of the structure only get the fields they know about, and
+         * the fields unknown to us are zeroed for callers built against a newer one. */
+        memset(buf, 0xff, sizeof(buf));
+        assert_se(sd_event_source_get_statistics(s, (sd_event_source_statistics*) buf, sizeof(uint64_t)) >= 0);
+        assert_se(buf[0] == 2);
+        assert_se(buf[1] == UINT64_MAX);
+
+        assert_se(sd_event_source_get_statistics(s, (sd_event_source_statistics*) buf, sizeof(buf)) >= 0);
+        assert_se(memcmp(buf, &st, sizeof(st)) == 0);
+        assert_se(buf[ELEMENTSOF(buf) - 2] == 0);
+        assert_se(buf[ELEMENTSOF(buf) - 1] == 0);
+
+        sd_event_source_unref(s);
+        sd_event_unref(e);
+}
+
 int main(int argc, char *argv[]) {
         test_setup_logging(LOG_DEBUG);
 
         test_basic();
         test_sd_event_now();
         test_rtqueue();
+        test_child_many(50);
+        test_child_disable_pending(false);
+        test_child_disable_pending(true);
+        test_dispatch_budget();
+        test_time_many(slow_tests_enabled() ? 100000 : 1000);
+        test_statistics();
 
         test_inotify(100); /* should work without overflow */
         test_inotify(33000); /* should trigger a q overflow */
@@ -79,6 +79,16 @@ typedef void* sd_event_child_handler_t;
 typedef int (*sd_event_inotify_handler_t)(sd_event_source *s, const struct inotify_event *event, void *userdata);
 typedef void (*sd_event_destroy_t)(void *userdata);
 
+/* Fields may be appended to this structure in later versions, hence pass sizeof(sd_event_source_statistics) to
+ * sd_event_source_get_statistics() along with it. */
+typedef struct sd_event_source_statistics {
+        uint64_t n_dispatched;      /* How often the callback was invoked */
+        uint64_t dispatch_usec;     /* Total time spent in the callback */
+        uint64_t dispatch_usec_max; /* Longest single invocation of the callback */
+        uint64_t pending_usec;      /* Total time spent pending before being dispatched */
+        uint64_t pending_usec_max;  /* Longest time spent pending before a single dispatch */
+} sd_event_source_statistics;
+
 int sd_event_default(sd_event **e);
 
 int sd_event_new(sd_event **e);
@@ -110,6 +120,8 @@ int sd_event_get_exit_code(sd_event *e, int *code);
 int sd_event_set_watchdog(sd_event *e, int b);
 int sd_event_get_watchdog(sd_event *e);
 int sd_event_get_iteration(sd_event *e, uint64_t *ret);
+int sd_event_set_dispatch_budget(sd_event *e, unsigned budget);
+int sd_event_get_dispatch_budget(sd_event *e, unsigned *ret);
 
 sd_event_source* sd_event_source_ref(sd_event_source *s);
 sd_event_source* sd_event_source_unref(sd_event_source *s);
@@ -143,6 +155,7 @@ int sd_event_source_get_child_pid(sd_event_source *s, pid_t *pid);
 int sd_event_source_get_inotify_mask(sd_event_source *s, uint32_t *ret);
 int sd_event_source_set_destroy_callback(sd_event_source *s, sd_event_destroy_t callback);
 int sd_event_source_get_destroy_callback(sd_event_source *s, sd_event_destroy_t *ret);
+int sd_event_source_get_statistics(sd_event_source *s, sd_event_source_statistics *ret, size_t size);
 
 /* Define helpers so that __attribute__((cleanup(sd_event_unrefp))) and similar may be used. */
 _SD_DEFINE_POINTER_CLEANUP_FUNC(sd_event, sd_event_unref);